@@ -0,0 +1,294 @@
+// times the stages of the per-frame pipeline on their own, printing one line
+// of ns/op percentiles per benchmark:
+//   name ns/op mean=... p50=... p90=... p99=... max=... ops=...
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libevdev/libevdev-uinput.h>
+#include <libevdev/libevdev.h>
+
+#include "config.h"
+#include "core.h"
+
+#define SAMPLES 2'000
+// samples run before the measured ones
+#define WARMUP 50
+
+// keeps results from being optimized away
+static volatile double sink;
+
+static int compare(const void *a, const void *b) {
+  const double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void report(const char *name, double samples[], size_t ops) {
+  double mean = 0;
+  for (int i = 0; i < SAMPLES; ++i)
+    mean += samples[i] / SAMPLES;
+  qsort(samples, SAMPLES, sizeof(*samples), compare);
+  printf("%s ns/op mean=%.2f p50=%.2f p90=%.2f p99=%.2f max=%.2f ops=%zu\n",
+         name, mean, samples[SAMPLES / 2], samples[SAMPLES * 9 / 10],
+         samples[SAMPLES * 99 / 100], samples[SAMPLES - 1], ops * SAMPLES);
+}
+
+// time run(data) doing ops operations per call
+static void measure(const char *name, void (*run)(void *data), void *data,
+                    size_t ops) {
+  static double samples[SAMPLES];
+  for (int i = -WARMUP; i < SAMPLES; ++i) {
+    const int64_t start = get_time();
+    run(data);
+    if (i >= 0)
+      samples[i] = (double)(get_time() - start) / (double)ops;
+  }
+  report(name, samples, ops);
+}
+
+// one second of reports of a 1 kHz pad, both sticks moving and a button
+// toggling now and then
+#define REPORTS 1'000
+#define REPORT_SIZE 6
+
+struct dispatch {
+  const struct config *config;
+  struct calibration calibration;
+  struct core core;
+  struct output_frame frame;
+  struct input_event events[REPORTS * REPORT_SIZE];
+};
+
+static void run_dispatch(void *data) {
+  struct dispatch *dispatch = data;
+  // every run replays the same second
+  core_init(&dispatch->core, dispatch->config, &dispatch->calibration, true,
+            0);
+  for (size_t i = 0; i < REPORTS * REPORT_SIZE; ++i) {
+    const struct input_event *ev = &dispatch->events[i];
+    core_event(&dispatch->core, ev, &dispatch->frame);
+    if (ev->type == EV_SYN)
+      frame_flush(&dispatch->frame);
+  }
+}
+
+// events as read from a gamepad fed to the core, the output going nowhere
+static void bench_dispatch(const struct config *config) {
+  static struct dispatch dispatch;
+  dispatch.config = config;
+  calibration_init(&dispatch.calibration);
+  dispatch.frame = (struct output_frame){.fd = -1};
+  for (int i = 0; i < REPORTS; ++i) {
+    const int64_t time = i * 1'000'000ll;
+    const double phase = i / 1e2;
+    const struct input_event report[REPORT_SIZE] = {
+        {.type = EV_ABS, .code = ABS_X, .value = (int)(24000 * sin(phase))},
+        {.type = EV_ABS, .code = ABS_Y, .value = (int)(24000 * cos(phase))},
+        {.type = EV_ABS, .code = ABS_RX, .value = (int)(12000 * sin(phase))},
+        {.type = EV_ABS, .code = ABS_RY, .value = (int)(12000 * cos(phase))},
+        {.type = EV_KEY, .code = BTN_SOUTH, .value = i / 100 % 2},
+        {.type = EV_SYN, .code = SYN_REPORT}};
+    for (int j = 0; j < REPORT_SIZE; ++j) {
+      struct input_event *ev = &dispatch.events[i * REPORT_SIZE + j];
+      *ev = report[j];
+      ev->input_event_sec = time / 1'000'000'000;
+      ev->input_event_usec = time % 1'000'000'000 / 1'000;
+    }
+  }
+  measure("dispatch", run_dispatch, &dispatch, REPORTS * REPORT_SIZE);
+}
+
+#define CURVE_OPS 4'096
+
+struct curve_bench {
+  const struct config *config;
+  const struct curve *curve;
+  int values[CURVE_OPS];
+};
+
+static void run_table(void *data) {
+  const struct curve_bench *bench = data;
+  double sum = 0;
+  for (int i = 0; i < CURVE_OPS; ++i)
+    sum += curve_speed(bench->curve, bench->values[i]);
+  sink = sum;
+}
+
+// the exponential curve of the left stick evaluated as it was before it
+// became a table, see config_build(), down to the integer division of the
+// exponent
+static void run_pow(void *data) {
+  const struct curve_bench *bench = data;
+  const struct config *config = bench->config;
+  double sum = 0;
+  for (int i = 0; i < CURVE_OPS; ++i) {
+    const int value = bench->values[i];
+    sum += pow(config->left_base / 1e3,
+               (double)((abs(value) - config->left_offset) /
+                        config->left_step)) /
+           (double)(1ll << config->left_shift) * config->left_mul * value *
+           (1 << SUBPIXEL_SHIFT);
+  }
+  sink = sum;
+}
+
+// the acceleration kernel: the speed of a stick at a position
+static void bench_curve(const struct config *config) {
+  static struct curve_bench bench;
+  bench.config = config;
+  bench.curve = &config->lcurve;
+  srand(1);
+  for (int i = 0; i < CURVE_OPS; ++i)
+    bench.values[i] = rand() % 65535 - 32767;
+  measure("curve_table", run_table, &bench, CURVE_OPS);
+  measure("curve_pow", run_pow, &bench, CURVE_OPS);
+}
+
+// passes over the channel blocks of all gamepads
+#define INTEGRATE_OPS 1'024
+#define BLOCKS 8
+
+static void run_vector(void *data) {
+  struct channels *blocks = data;
+  for (int i = 0; i < INTEGRATE_OPS; ++i)
+    for (int j = 0; j < BLOCKS; ++j)
+      channels_integrate(&blocks[j], 8'000'000 + i % 2);
+}
+
+static void run_scalar(void *data) {
+  struct channels *blocks = data;
+  for (int i = 0; i < INTEGRATE_OPS; ++i)
+    for (int j = 0; j < BLOCKS; ++j)
+      channels_integrate_scalar(&blocks[j], 8'000'000 + i % 2);
+}
+
+// integrating the channels of a gamepad, as one vector and as the scalar
+// reference, which have to agree
+static void bench_integrate(const struct config *config) {
+  static struct channels vector[BLOCKS], scalar[BLOCKS];
+  srand(1);
+  for (int i = 0; i < BLOCKS; ++i)
+    for (int j = 0; j < CHANNELS; ++j)
+      vector[i].speed[j] =
+          curve_speed(&config->lcurve, rand() % 65535 - 32767);
+  memcpy(scalar, vector, sizeof(vector));
+  measure("integrate_vector", run_vector, vector, INTEGRATE_OPS * BLOCKS);
+  measure("integrate_scalar", run_scalar, scalar, INTEGRATE_OPS * BLOCKS);
+  for (int i = 0; i < BLOCKS; ++i)
+    for (int j = 0; j < CHANNELS; ++j)
+      if (vector[i].motion[j] != scalar[i].motion[j])
+        errx(EXIT_FAILURE, "vector and scalar integration disagree");
+}
+
+#define FRAME_OPS 256
+
+static void discard(void *data, const struct input_event *events,
+                    size_t count) {
+  (void)data;
+  sink = events[count - 1].value;
+}
+
+static void run_frame(void *data) {
+  struct output_frame *frame = data;
+  for (int i = 0; i < FRAME_OPS; ++i) {
+    frame_emit(frame, EV_REL, REL_X, i % 7 - 3);
+    frame_emit(frame, EV_REL, REL_Y, i % 5 - 2);
+    frame_key(frame, KEY_LEFTCTRL, i % 2);
+    frame_flush(frame);
+  }
+}
+
+// building a frame of pointer motion and a key, handed to a sink
+static void bench_frame(void) {
+  static struct output_frame frame = {.fd = -1, .sink = discard};
+  measure("frame", run_frame, &frame, FRAME_OPS);
+}
+
+// fits a pipe, which is emptied between samples
+#define WRITE_OPS 128
+
+struct write_bench {
+  int fd, drain;
+};
+
+static void run_write(void *data) {
+  const struct write_bench *bench = data;
+  for (int i = 0; i < WRITE_OPS; ++i) {
+    // back and forth, so a real pointer does not go anywhere
+    const struct input_event frame[3] = {
+        {.type = EV_REL, .code = REL_X, .value = i % 2 ? 1 : -1},
+        {.type = EV_REL, .code = REL_Y, .value = i % 2 ? 1 : -1},
+        {.type = EV_SYN, .code = SYN_REPORT}};
+    if (write(bench->fd, frame, sizeof(frame)) < 0)
+      err(EXIT_FAILURE, "failed to write events");
+  }
+  if (bench->drain >= 0) {
+    char buf[WRITE_OPS * sizeof(struct input_event[3])];
+    if (read(bench->drain, buf, sizeof(buf)) < 0)
+      err(EXIT_FAILURE, "failed to drain pipe");
+  }
+}
+
+// writing a frame to a uinput device where allowed, otherwise into a pipe
+static void bench_write(void) {
+  struct libevdev *dev = libevdev_new();
+  libevdev_set_name(dev, "Joy2KeyMouse Benchmark");
+  libevdev_enable_event_type(dev, EV_REL);
+  libevdev_enable_event_code(dev, EV_REL, REL_X, nullptr);
+  libevdev_enable_event_code(dev, EV_REL, REL_Y, nullptr);
+  struct libevdev_uinput *uinput = nullptr;
+  const int rc = libevdev_uinput_create_from_device(
+      dev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uinput);
+  libevdev_free(dev);
+
+  if (rc == 0) {
+    struct write_bench bench = {.fd = libevdev_uinput_get_fd(uinput),
+                                .drain = -1};
+    measure("write_uinput", run_write, &bench, WRITE_OPS);
+    libevdev_uinput_destroy(uinput);
+    return;
+  }
+  errno = -rc;
+  warn("no uinput device, writing into a pipe instead");
+  int fds[2];
+  if (pipe(fds) < 0)
+    err(EXIT_FAILURE, "failed to create pipe");
+  struct write_bench bench = {.fd = fds[1], .drain = fds[0]};
+  measure("write_pipe", run_write, &bench, WRITE_OPS);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+int main(int argc, char *argv[]) {
+  struct config *config = malloc(sizeof(*config));
+  if (config == nullptr)
+    err(EXIT_FAILURE, "failed to allocate config");
+  config_init(config);
+
+  // all of them unless some are named
+  const char *const all[] = {"dispatch", "curve", "integrate", "frame",
+                             "write"};
+  const char *const *names = argc > 1 ? (const char *const *)argv + 1 : all;
+  const int count = argc > 1 ? argc - 1 : (int)(sizeof(all) / sizeof(*all));
+  for (int i = 0; i < count; ++i)
+    if (strcmp(names[i], "dispatch") == 0)
+      bench_dispatch(config);
+    else if (strcmp(names[i], "curve") == 0)
+      bench_curve(config);
+    else if (strcmp(names[i], "integrate") == 0)
+      bench_integrate(config);
+    else if (strcmp(names[i], "frame") == 0)
+      bench_frame();
+    else if (strcmp(names[i], "write") == 0)
+      bench_write();
+    else
+      errx(EXIT_FAILURE, "unknown benchmark: %s", names[i]);
+  free(config);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+// replays a gamepad trace (recorded with -o, or synthesized if none is given)
+// through the mapping core into a null sink
+
+#include <err.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "core.h"
+#include "engine.h"
+#include "trace.h"
+
+struct event {
+  struct input_event ev;
+  unsigned int slot;
+};
+
+struct events {
+  struct event *data;
+  size_t count, capacity;
+  // slots any event was read from
+  uint32_t slots;
+};
+
+static void push(struct events *events, unsigned int slot, int64_t time,
+                 uint16_t type, uint16_t code, int32_t value) {
+  if (events->count == events->capacity) {
+    events->capacity = events->capacity ? events->capacity * 2 : 1024;
+    events->data =
+        realloc(events->data, events->capacity * sizeof(*events->data));
+    if (events->data == nullptr)
+      err(EXIT_FAILURE, "failed to allocate events");
+  }
+  events->data[events->count++] = (struct event){
+      .ev = {.input_event_sec = time / 1'000'000'000,
+             .input_event_usec = time % 1'000'000'000 / 1'000,
+             .type = type,
+             .code = code,
+             .value = value},
+      .slot = slot};
+  events->slots |= 1u << slot;
+}
+
+// ten seconds of a 1 kHz pad: both sticks circling, a button, the hat and a
+// trigger toggling every few hundred milliseconds
+static void synthesize(struct events *events) {
+  for (int ms = 0; ms < 10'000; ++ms) {
+    const int64_t time = ms * 1'000'000ll;
+    const double phase = ms / 1e3;
+    push(events, 0, time, EV_ABS, ABS_X, (int)(24000 * sin(phase)));
+    push(events, 0, time, EV_ABS, ABS_Y, (int)(24000 * cos(phase)));
+    push(events, 0, time, EV_ABS, ABS_RX, (int)(12000 * sin(phase * 3)));
+    push(events, 0, time, EV_ABS, ABS_RY, (int)(30000 * cos(phase / 2)));
+    if (ms % 250 == 0)
+      push(events, 0, time, EV_KEY, BTN_SOUTH, ms / 250 % 2);
+    if (ms % 400 == 0)
+      push(events, 0, time, EV_ABS, ABS_HAT0X, ms / 400 % 3 - 1);
+    if (ms % 300 == 0)
+      push(events, 0, time, EV_ABS, ABS_Z, ms / 300 % 2 ? 1023 : 0);
+    push(events, 0, time, EV_SYN, SYN_REPORT, 0);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  struct events events = {};
+  if (argc > 1) {
+    FILE *file = trace_open(argv[1]);
+    if (file == nullptr)
+      err(EXIT_FAILURE, "failed to open trace %s", argv[1]);
+    unsigned int slot;
+    for (struct input_event ev; trace_read(file, &slot, &ev);) {
+      if (slot >= MAX_GAMEPADS)
+        errx(EXIT_FAILURE, "invalid slot %u in trace", slot);
+      push(&events, slot, event_time(&ev), ev.type, ev.code, ev.value);
+    }
+    fclose(file);
+  } else {
+    synthesize(&events);
+  }
+  if (events.count == 0)
+    errx(EXIT_FAILURE, "empty trace");
+
+  struct config config;
+  config_init(&config);
+  // traces do not record axis ranges, assume those of an xpad
+  struct calibration calibration;
+  calibration_init(&calibration);
+  calibrate_axis(&calibration.axes[ABS_Z], 0, 1023);
+  calibrate_axis(&calibration.axes[ABS_RZ], 0, 1023);
+  const int64_t tick_period = 1'000'000'000 / config.tick_rate;
+  const int rounds = 20;
+  uint64_t emitted = 0;
+  const int64_t start = get_time();
+  for (int round = 0; round < rounds; ++round) {
+    // a core per gamepad, all writing into the same frame as in the engine
+    struct core cores[MAX_GAMEPADS];
+    for (uint32_t slots = events.slots; slots; slots &= slots - 1)
+      core_init(&cores[__builtin_ctz(slots)], &config, &calibration, true,
+                event_time(&events.data[0].ev));
+    struct output_frame frame = {.fd = -1};
+    bool ticking = false;
+    int64_t next_tick = 0;
+    for (size_t i = 0; i < events.count; ++i) {
+      const struct input_event *ev = &events.data[i].ev;
+      struct core *core = &cores[events.data[i].slot];
+      const int64_t time = event_time(ev);
+      for (; ticking && next_tick <= time; next_tick += tick_period) {
+        for (uint32_t slots = events.slots; slots; slots &= slots - 1)
+          core_tick(&cores[__builtin_ctz(slots)], next_tick, &frame);
+        frame_flush(&frame);
+      }
+      core_event(core, ev, &frame);
+      if (ev->type != EV_SYN)
+        continue;
+      core_tick(core, 0, &frame);
+      frame_flush(&frame);
+      bool active = false;
+      for (uint32_t slots = events.slots; slots; slots &= slots - 1)
+        active |= core_active(&cores[__builtin_ctz(slots)]);
+      if (ticking != active && (ticking = !ticking))
+        next_tick = time + tick_period;
+    }
+    emitted += frame.emitted;
+  }
+  const int64_t elapsed = get_time() - start;
+
+  const double total = (double)events.count * rounds;
+  printf("%zu events x %d rounds: %.0f events/s, %.1f ns/event, %" PRIu64
+         " output events per round\n",
+         events.count, rounds, total * 1e9 / (double)elapsed,
+         (double)elapsed / total, emitted / rounds);
+  free(events.data);
+  return EXIT_SUCCESS;
+}
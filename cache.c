@@ -0,0 +1,89 @@
+#include "cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char magic[] = "J2KCACHE";
+static const uint32_t version = 3;
+
+struct cache_entry *cache_find(struct cache *cache,
+                               const struct device_id *id) {
+  for (unsigned int i = 0; i < cache->count; ++i)
+    if (memcmp(&cache->entries[i].id, id, sizeof(*id)) == 0) {
+      cache->entries[i].used = ++cache->clock;
+      return &cache->entries[i];
+    }
+  return nullptr;
+}
+
+struct cache_entry *cache_add(struct cache *cache, const struct device_id *id) {
+  struct cache_entry *entry = &cache->entries[cache->count];
+  if (cache->count == sizeof(cache->entries) / sizeof(*cache->entries)) {
+    entry = &cache->entries[0];
+    for (unsigned int i = 1; i < cache->count; ++i)
+      if (cache->entries[i].used < entry->used)
+        entry = &cache->entries[i];
+  } else {
+    ++cache->count;
+  }
+  *entry = (struct cache_entry){.id = *id, .used = ++cache->clock};
+  return entry;
+}
+
+bool cache_load(struct cache *cache, const char *path) {
+  *cache = (struct cache){};
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr)
+    return errno == ENOENT;
+  char header[sizeof(magic) - 1];
+  uint32_t file_version, entry_size;
+  bool ok = fread(header, sizeof(header), 1, file) == 1 &&
+            fread(&file_version, sizeof(file_version), 1, file) == 1 &&
+            fread(&entry_size, sizeof(entry_size), 1, file) == 1 &&
+            memcmp(header, magic, sizeof(header)) == 0 &&
+            file_version == version &&
+            entry_size == sizeof(struct cache_entry);
+  while (ok &&
+         cache->count < sizeof(cache->entries) / sizeof(*cache->entries) &&
+         fread(&cache->entries[cache->count], sizeof(struct cache_entry), 1,
+               file) == 1) {
+    const uint64_t used = cache->entries[cache->count++].used;
+    if (used > cache->clock)
+      cache->clock = used;
+  }
+  ok = ok && !ferror(file);
+  fclose(file);
+  if (!ok) {
+    *cache = (struct cache){};
+    errno = EINVAL;
+  }
+  return ok;
+}
+
+bool cache_save(const struct cache *cache, const char *path) {
+  // write a new file and move it over the old one, so a crash cannot leave a
+  // truncated cache behind
+  char tmp[4096];
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  FILE *file = fopen(tmp, "wb");
+  if (file == nullptr)
+    return false;
+  const uint32_t entry_size = sizeof(struct cache_entry);
+  bool ok = fwrite(magic, sizeof(magic) - 1, 1, file) == 1 &&
+            fwrite(&version, sizeof(version), 1, file) == 1 &&
+            fwrite(&entry_size, sizeof(entry_size), 1, file) == 1 &&
+            (cache->count == 0 ||
+             fwrite(cache->entries, sizeof(struct cache_entry), cache->count,
+                    file) == cache->count);
+  ok = fclose(file) == 0 && ok;
+  if (ok && rename(tmp, path) == 0)
+    return true;
+  const int saved = errno;
+  remove(tmp);
+  errno = saved;
+  return false;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "core.h"
+
+// what a device is recognized by across reconnects
+struct device_id {
+  uint16_t bustype, vendor, product, version;
+  char uniq[64];
+};
+
+struct cache_entry {
+  struct device_id id;
+  struct calibration calibration;
+  // when the entry has last been looked up, the oldest entry is replaced
+  uint64_t used;
+};
+
+// a cache file is "J2KCACHE", a uint32 version, the uint32 size of an entry
+// and then the entries in host byte order
+struct cache {
+  uint64_t clock;
+  unsigned int count;
+  struct cache_entry entries[32];
+};
+
+// returns the entry of the device, or nullptr if it is not cached
+[[nodiscard]] struct cache_entry *cache_find(struct cache *cache,
+                                             const struct device_id *id);
+// returns a new entry of the device, replacing the least recently used one if
+// the cache is full; its calibration is left for the caller to fill in
+[[nodiscard]] struct cache_entry *cache_add(struct cache *cache,
+                                            const struct device_id *id);
+// a missing file loads as an empty cache
+[[nodiscard]] bool cache_load(struct cache *cache, const char *path);
+[[nodiscard]] bool cache_save(const struct cache *cache, const char *path);
@@ -0,0 +1,433 @@
+#include "config.h"
+
+#include <assert.h>
+#include <err.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libevdev/libevdev.h>
+
+#ifndef HAVE_PROFILE
+// keep in sync with joy2keymouse.conf
+static const char default_config[] = "tick_rate = 125\n"
+                                     "timing = event\n"
+                                     "left_curve = exponential\n"
+                                     "right_curve = exponential\n"
+                                     "left_base = 1010\n"
+                                     "left_step = 512\n"
+                                     "left_offset = 8192\n"
+                                     "left_shift = 36\n"
+                                     "left_mul = 1\n"
+                                     "right_base = 1010\n"
+                                     "right_step = 512\n"
+                                     "right_offset = 8192\n"
+                                     "right_shift = 36\n"
+                                     "right_mul = 2\n"
+                                     "scroll_momentum = 0\n"
+                                     "tap_time = 200\n"
+                                     "combo_time = 50\n"
+                                     "repeat_delay = 0\n"
+                                     "repeat_rate = 20\n"
+                                     "repeat_max_rate = 20\n"
+                                     "repeat_ramp = 1000\n"
+                                     "refresh_rate = 0\n"
+                                     "frame_lead = 2000\n"
+                                     "gyro_yaw = 0\n"
+                                     "gyro_pitch = 0\n"
+                                     "gyro_deadzone = 1\n"
+                                     "ABS_X = left_x\n"
+                                     "ABS_Y = left_y\n"
+                                     "ABS_RX = right_x\n"
+                                     "ABS_RY = right_y\n"
+                                     "ABS_HAT0X = hat KEY_LEFT KEY_RIGHT\n"
+                                     "ABS_HAT0Y = hat KEY_UP KEY_DOWN\n"
+                                     "ABS_Z = trigger KEY_LEFTCTRL\n"
+                                     "ABS_RZ = trigger KEY_LEFTSHIFT\n"
+                                     "BTN_SOUTH = BTN_LEFT\n"
+                                     "BTN_EAST = BTN_RIGHT\n"
+                                     "BTN_WEST = BTN_EXTRA\n"
+                                     "BTN_NORTH = BTN_SIDE\n"
+                                     "BTN_SELECT = KEY_LEFTMETA\n"
+                                     "BTN_START = KEY_LEFTMETA+KEY_A\n"
+                                     "BTN_TL = KEY_LEFTSHIFT+KEY_TAB\n"
+                                     "BTN_TR = KEY_TAB\n"
+                                     "BTN_THUMBL = KEY_LEFTALT\n"
+                                     "BTN_THUMBR = KEY_ENTER\n"
+                                     "BTN_DPAD_UP = KEY_UP\n"
+                                     "BTN_DPAD_DOWN = KEY_DOWN\n"
+                                     "BTN_DPAD_LEFT = KEY_LEFT\n"
+                                     "BTN_DPAD_RIGHT = KEY_RIGHT\n";
+#endif
+
+static const struct mapping empty_mapping = {.binding_count = 1,
+                                             .chord_count = 1};
+
+[[nodiscard]] static char *trim(char *s) {
+  while (*s == ' ' || *s == '\t')
+    ++s;
+  char *end = s + strlen(s);
+  while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' ||
+                     end[-1] == '\r'))
+    --end;
+  *end = '\0';
+  return s;
+}
+
+// returns the chord index, or -1 if the chord is invalid or the table is full
+[[nodiscard]] static int parse_chord(struct mapping *mapping, char *spec) {
+  if (strcmp(spec, "none") == 0)
+    return 0;
+
+  struct chord chord = {};
+  char *saveptr;
+  for (char *name = strtok_r(spec, "+", &saveptr); name;
+       name = strtok_r(nullptr, "+", &saveptr)) {
+    const int code = libevdev_event_code_from_name(EV_KEY, name);
+    if (code < 0 || chord.count == CHORD_SIZE)
+      return -1;
+    chord.codes[chord.count++] = (uint16_t)code;
+  }
+  if (chord.count == 0)
+    return -1;
+
+  for (unsigned int i = 1; i < mapping->chord_count; ++i)
+    if (memcmp(&mapping->chords[i], &chord, sizeof(chord)) == 0)
+      return (int)i;
+  if (mapping->chord_count ==
+      sizeof(mapping->chords) / sizeof(*mapping->chords))
+    return -1;
+  mapping->chords[mapping->chord_count] = chord;
+  return (int)mapping->chord_count++;
+}
+
+// a missing argument keeps the default
+[[nodiscard]] static bool parse_uint8(const char *arg, long minimum,
+                                      long maximum, uint8_t *number) {
+  if (arg == nullptr)
+    return true;
+  char *end;
+  const long value = strtol(arg, &end, 10);
+  if (*arg == '\0' || *end != '\0' || value < minimum || value > maximum)
+    return false;
+  *number = (uint8_t)value;
+  return true;
+}
+
+// "CHORD", "layer N" or "tap CHORD hold CHORD|layer N"; returns the binding
+// index, or -1 if the binding is invalid or the table is full
+[[nodiscard]] static int parse_binding(struct mapping *mapping, char *spec) {
+  char *saveptr, *args[6];
+  for (int i = 0; i < 6; ++i)
+    args[i] = strtok_r(i ? nullptr : spec, " \t", &saveptr);
+
+  struct binding binding = {};
+  char **held = args;
+  int chord;
+  if (args[0] && strcmp(args[0], "tap") == 0) {
+    if (args[1] == nullptr || args[2] == nullptr ||
+        strcmp(args[2], "hold") != 0 ||
+        (chord = parse_chord(mapping, args[1])) < 0)
+      return -1;
+    binding.chord = (uint8_t)chord;
+    binding.tap_hold = true;
+    held = args + 3;
+  }
+  if (held[0] == nullptr)
+    return -1;
+  if (strcmp(held[0], "layer") == 0) {
+    if (held[1] == nullptr || held[2] ||
+        !parse_uint8(held[1], 1, MAX_LAYERS - 1, &binding.layer))
+      return -1;
+  } else {
+    if (held[1] || (chord = parse_chord(mapping, held[0])) < 0)
+      return -1;
+    *(binding.tap_hold ? &binding.hold_chord : &binding.chord) =
+        (uint8_t)chord;
+  }
+
+  for (unsigned int i = 0; i < mapping->binding_count; ++i)
+    if (memcmp(&mapping->bindings[i], &binding, sizeof(binding)) == 0)
+      return (int)i;
+  if (mapping->binding_count ==
+      sizeof(mapping->bindings) / sizeof(*mapping->bindings))
+    return -1;
+  mapping->bindings[mapping->binding_count] = binding;
+  return (int)mapping->binding_count++;
+}
+
+// "INPUT+INPUT = BINDING"
+[[nodiscard]] static bool map_combo(struct mapping *mapping, const char *key,
+                                    char *value) {
+  char inputs[64], *saveptr;
+  if (strlen(key) >= sizeof(inputs))
+    return false;
+  strcpy(inputs, key);
+  struct combo combo = {};
+  for (int i = 0; i < 2; ++i) {
+    const char *name = strtok_r(i ? nullptr : inputs, "+", &saveptr);
+    const int code = name ? libevdev_event_code_from_name(EV_KEY, name) : -1;
+    if (code < 0)
+      return false;
+    combo.inputs[i] = (uint16_t)code;
+  }
+  if (strtok_r(nullptr, "+", &saveptr) || combo.inputs[0] == combo.inputs[1])
+    return false;
+  const int binding = parse_binding(mapping, value);
+  if (binding < 0)
+    return false;
+  combo.binding = (uint8_t)binding;
+
+  unsigned int i = 0;
+  while (i < mapping->combo_count &&
+         memcmp(mapping->combo_table[i].inputs, combo.inputs,
+                sizeof(combo.inputs)) != 0)
+    ++i;
+  if (i == MAX_COMBOS)
+    return false;
+  if (i == mapping->combo_count)
+    ++mapping->combo_count;
+  mapping->combo_table[i] = combo;
+  mapping->combos[combo.inputs[0]] |= 1u << i;
+  mapping->combos[combo.inputs[1]] |= 1u << i;
+  return true;
+}
+
+[[nodiscard]] static bool map_key(struct mapping *mapping, unsigned int layer,
+                                  const char *key, char *value) {
+  const int code = libevdev_event_code_from_name(EV_KEY, key);
+  if (code < 0)
+    return false;
+  const int binding = parse_binding(mapping, value);
+  if (binding < 0)
+    return false;
+  mapping->keys[layer][code] = (uint8_t)binding;
+  return true;
+}
+
+[[nodiscard]] static bool map_axis(struct mapping *mapping,
+                                   struct axis_mapping *axis, char *value) {
+  const char *const roles[] = {
+      [AXIS_UNMAPPED] = "none",   [AXIS_LEFT_X] = "left_x",
+      [AXIS_LEFT_Y] = "left_y",   [AXIS_RIGHT_X] = "right_x",
+      [AXIS_RIGHT_Y] = "right_y", [AXIS_HAT] = "hat",
+      [AXIS_TRIGGER] = "trigger", [AXIS_PRECISION] = "precision",
+      [AXIS_SCROLL_UP] = "scroll_up", [AXIS_SCROLL_DOWN] = "scroll_down",
+  };
+  char *saveptr;
+  const char *role = strtok_r(value, " \t", &saveptr);
+  if (role == nullptr)
+    return false;
+  char *args[4] = {};
+  for (int i = 0; i < 4; ++i)
+    args[i] = strtok_r(nullptr, " \t", &saveptr);
+
+  *axis = (struct axis_mapping){};
+  for (uint8_t i = 0; i < sizeof(roles) / sizeof(*roles); ++i)
+    if (strcmp(role, roles[i]) == 0)
+      axis->role = i;
+  int negative = 0, positive = 0;
+  switch (axis->role) {
+  case AXIS_UNMAPPED:
+    return strcmp(role, "none") == 0 && args[0] == nullptr;
+  case AXIS_HAT:
+    if (args[0] == nullptr || args[1] == nullptr || args[2] ||
+        (negative = parse_chord(mapping, args[0])) < 0 ||
+        (positive = parse_chord(mapping, args[1])) < 0)
+      return false;
+    break;
+  case AXIS_TRIGGER:
+    axis->percent[0] = 50;
+    if (args[0] == nullptr || args[3] ||
+        (positive = parse_chord(mapping, args[0])) < 0 ||
+        !parse_uint8(args[1], 2, 100, &axis->percent[0]))
+      return false;
+    axis->percent[1] = axis->percent[0] / 2;
+    if (!parse_uint8(args[2], 1, axis->percent[0] - 1, &axis->percent[1]))
+      return false;
+    break;
+  case AXIS_PRECISION:
+    axis->percent[0] = 25;
+    return args[1] == nullptr &&
+           parse_uint8(args[0], 0, 99, &axis->percent[0]);
+  case AXIS_SCROLL_UP:
+  case AXIS_SCROLL_DOWN:
+    axis->percent[0] = 100;
+    return args[1] == nullptr &&
+           parse_uint8(args[0], 1, 100, &axis->percent[0]);
+  default:
+    return args[0] == nullptr;
+  }
+  axis->chords[0] = (uint8_t)negative;
+  axis->chords[1] = (uint8_t)positive;
+  return true;
+}
+
+// named as the field, so that the generated profile can use the names as
+// designators
+#define NUMBER(field, minimum, maximum)                                       \
+  {#field, offsetof(struct config, field), minimum, maximum}
+
+const struct config_number config_numbers[] = {
+    NUMBER(tick_rate, 1, 1000),
+    NUMBER(left_base, 1'000, 1'020),
+    NUMBER(left_step, 256, 4'096),
+    NUMBER(left_offset, 0, 32'767),
+    NUMBER(left_shift, 30, 42),
+    NUMBER(left_mul, 1, 16),
+    NUMBER(right_base, 1'000, 1'020),
+    NUMBER(right_step, 256, 4'096),
+    NUMBER(right_offset, 0, 32'767),
+    NUMBER(right_shift, 30, 42),
+    NUMBER(right_mul, 1, 16),
+    NUMBER(scroll_momentum, 0, 10'000),
+    NUMBER(tap_time, 1, 5'000),
+    NUMBER(combo_time, 1, 5'000),
+    NUMBER(repeat_delay, 0, 5'000),
+    NUMBER(repeat_rate, 1, 100),
+    NUMBER(repeat_max_rate, 1, 100),
+    NUMBER(repeat_ramp, 0, 10'000),
+    NUMBER(refresh_rate, 0, 1'000),
+    NUMBER(frame_lead, 0, 50'000),
+    NUMBER(gyro_yaw, -1'000, 1'000),
+    NUMBER(gyro_pitch, -1'000, 1'000),
+    NUMBER(gyro_deadzone, 0, 100),
+};
+static_assert(sizeof(config_numbers) / sizeof(*config_numbers) ==
+              CONFIG_NUMBERS);
+
+bool config_set(struct config *config, const char *key, char *value) {
+  for (size_t i = 0; i < CONFIG_NUMBERS; ++i)
+    if (strcmp(key, config_numbers[i].name) == 0) {
+      char *end;
+      const long number = strtol(value, &end, 10);
+      if (*value == '\0' || *end != '\0' ||
+          number < config_numbers[i].minimum ||
+          number > config_numbers[i].maximum)
+        return false;
+      *(int *)((char *)config + config_numbers[i].offset) = (int)number;
+      return true;
+    }
+
+  if (strcmp(key, "timing") == 0) {
+    if (strcmp(value, "event") == 0)
+      config->event_timing = true;
+    else if (strcmp(value, "wakeup") == 0)
+      config->event_timing = false;
+    else
+      return false;
+  } else if (strcmp(key, "left_curve") == 0 ||
+             strcmp(key, "right_curve") == 0) {
+    const int shape = parse_curve_shape(value);
+    if (shape < 0)
+      return false;
+    *(key[0] == 'l' ? &config->lshape : &config->rshape) = shape;
+  } else if (strncmp(key, "ABS_", 4) == 0) {
+    const int code = libevdev_event_code_from_name(EV_ABS, key);
+    return code >= 0 &&
+           map_axis(&config->mapping, &config->mapping.axes[code], value);
+  } else if (strchr(key, '+')) {
+    return map_combo(&config->mapping, key, value);
+  } else {
+    return map_key(&config->mapping, 0, key, value);
+  }
+  return true;
+}
+
+[[nodiscard]] static bool load_stream(struct config *config, FILE *file,
+                                      const char *source) {
+  bool ok = true, mapped = false;
+  unsigned int layer = 0;
+  char *line = nullptr;
+  size_t size = 0;
+  for (int lineno = 1; getline(&line, &size, file) >= 0; ++lineno) {
+    char *const comment = strchr(line, '#');
+    if (comment)
+      *comment = '\0';
+    char *const stripped = trim(line);
+    if (*stripped == '\0')
+      continue;
+
+    if (*stripped == '[') {
+      int number, length = 0;
+      if (sscanf(stripped, "[layer %d]%n", &number, &length) != 1 ||
+          length == 0 || stripped[length] != '\0' || number < 1 ||
+          number >= MAX_LAYERS) {
+        warnx("%s:%d: expected \"[layer N]\" with N from 1 to %d", source,
+              lineno, MAX_LAYERS - 1);
+        ok = false;
+        continue;
+      }
+      layer = (unsigned int)number;
+      if (!mapped)
+        config->mapping = empty_mapping;
+      mapped = true;
+      continue;
+    }
+
+    char *const equals = strchr(stripped, '=');
+    if (equals == nullptr) {
+      warnx("%s:%d: expected \"name = value\"", source, lineno);
+      ok = false;
+      continue;
+    }
+    *equals = '\0';
+    const char *const key = trim(stripped);
+    char *const value = trim(equals + 1);
+
+    const bool mapping = strncmp(key, "ABS_", 4) == 0 ||
+                         strncmp(key, "BTN_", 4) == 0 ||
+                         strncmp(key, "KEY_", 4) == 0;
+    if (mapping && !mapped) {
+      config->mapping = empty_mapping;
+      mapped = true;
+    }
+    // layers only bind buttons, the rest is shared by all of them
+    if (layer ? strchr(key, '+') ||
+                    (strncmp(key, "BTN_", 4) != 0 &&
+                     strncmp(key, "KEY_", 4) != 0) ||
+                    !map_key(&config->mapping, layer, key, value)
+              : !config_set(config, key, value)) {
+      warnx("%s:%d: invalid setting of %s", source, lineno, key);
+      ok = false;
+    }
+  }
+  free(line);
+  return ok;
+}
+
+void config_init(struct config *config) {
+#ifdef HAVE_PROFILE
+  *config = builtin_config;
+#else
+  *config = (struct config){.mapping = empty_mapping};
+  FILE *file =
+      fmemopen((void *)default_config, sizeof(default_config) - 1, "r");
+  if (file == nullptr || !load_stream(config, file, "built-in config"))
+    errx(EXIT_FAILURE, "failed to load built-in config");
+  fclose(file);
+  config_build(config);
+#endif
+}
+
+bool config_load(struct config *config, const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == nullptr) {
+    warn("failed to open %s", path);
+    return false;
+  }
+  const bool ok = load_stream(config, file, path);
+  fclose(file);
+  config_build(config);
+  return ok;
+}
+
+void config_build(struct config *config) {
+  build_curve(&config->lcurve, config->lshape, config->left_base / 1e3,
+              config->left_step, config->left_offset, 1ll << config->left_shift,
+              config->left_mul);
+  build_curve(&config->rcurve, config->rshape, config->right_base / 1e3,
+              config->right_step, config->right_offset,
+              1ll << config->right_shift, config->right_mul);
+}
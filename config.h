@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "core.h"
+
+struct config {
+  int tick_rate;
+  bool event_timing;
+  enum curve_shape lshape, rshape;
+  // exponential curve of the left (pointer) and right (wheel) stick: at
+  // deflection d of 32767 the stick moves d * mul * (base / 1000) ^
+  // ((d - offset) / step) / 2 ^ shift units per ns, which the other shapes
+  // reach at full deflection
+  int left_base, left_step, left_offset, left_shift, left_mul;
+  int right_base, right_step, right_offset, right_shift, right_mul;
+  // time constant in ms of the wheel gliding on after the right stick is
+  // released, 0 to stop right away
+  int scroll_momentum;
+  // ms within which a tap/hold button is tapped, and within which the buttons
+  // of a combo have to be pressed
+  int tap_time, combo_time;
+  // ms after which a held D-pad or hat direction starts repeating, or 0 not
+  // to repeat; the rate in Hz ramps up to the maximum over repeat_ramp ms
+  int repeat_delay, repeat_rate, repeat_max_rate, repeat_ramp;
+  // display refresh rate in Hz to tick at instead of tick_rate, or 0, and how
+  // many us before each vblank a frame is written, its motion being
+  // extrapolated over them
+  int refresh_rate, frame_lead;
+  // pointer units per degree the gyro of a motion sensor yaws and pitches,
+  // negative to invert, 0 for none, and the degrees per second below which
+  // it is taken to be still
+  int gyro_yaw, gyro_pitch, gyro_deadzone;
+  struct curve lcurve, rcurve;
+  struct mapping mapping;
+};
+
+// the integer settings and the ranges they are read in, named as their fields
+struct config_number {
+  const char *name;
+  size_t offset;
+  long minimum, maximum;
+};
+#define CONFIG_NUMBERS 23
+extern const struct config_number config_numbers[CONFIG_NUMBERS];
+
+#ifdef HAVE_PROFILE
+// generated from the profile given at build time
+extern const struct config builtin_config;
+#endif
+
+// the built-in configuration, see joy2keymouse.conf, or the profile given at
+// build time
+void config_init(struct config *config);
+// settings in the file override the current ones, and if the file maps any
+// input its mapping replaces the current mapping; returns false on errors,
+// which have been reported
+[[nodiscard]] bool config_load(struct config *config, const char *path);
+// apply one "key = value" line without the "="
+[[nodiscard]] bool config_set(struct config *config, const char *key,
+                              char *value);
+// build the tables derived from the settings
+void config_build(struct config *config);
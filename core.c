@@ -0,0 +1,686 @@
+#include "core.h"
+
+#include "config.h"
+
+#include <err.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+const clockid_t clock_id = CLOCK_MONOTONIC;
+
+int64_t get_time(void) {
+  struct timespec ts;
+  clock_gettime(clock_id, &ts);
+  return ts.tv_sec * 1'000'000'000ll + ts.tv_nsec;
+}
+
+int64_t event_time(const struct input_event *ev) {
+  return ev->input_event_sec * 1'000'000'000ll + ev->input_event_usec * 1'000ll;
+}
+
+static void frame_push(struct output_frame *frame, uint16_t type,
+                       uint16_t code, int32_t value) {
+  frame->events[frame->count++] =
+      (struct input_event){.type = type, .code = code, .value = value};
+  ++frame->emitted;
+}
+
+void frame_flush(struct output_frame *frame) {
+  if (frame->start != frame->count)
+    frame_push(frame, EV_SYN, SYN_REPORT, 0);
+  if (frame->count == 0)
+    return;
+  if (frame->sink)
+    frame->sink(frame->sink_data, frame->events, frame->count);
+  else if (frame->fd >= 0 &&
+           write(frame->fd, frame->events,
+                 frame->count * sizeof(struct input_event)) < 0)
+    warn("failed to write events");
+  frame->count = frame->start = 0;
+  ++frame->writes;
+
+  stats_count(&stats->frames, 1);
+  if (!stats->enabled)
+    return;
+  const int64_t time = get_time();
+  for (int i = 0; i < STATS_CLASSES; ++i)
+    if (frame->input_time[i]) {
+      stats_record(&stats->latency[i], (uint64_t)(time - frame->input_time[i]));
+      frame->input_time[i] = 0;
+    }
+}
+
+void frame_mark(struct output_frame *frame, enum stats_class class,
+                int64_t time) {
+  if (frame->input_time[class] == 0 || time < frame->input_time[class])
+    frame->input_time[class] = time;
+}
+
+void frame_emit(struct output_frame *frame, uint16_t type, uint16_t code,
+                int32_t value) {
+  if (frame->count + 2 >= sizeof(frame->events) / sizeof(*frame->events))
+    frame_flush(frame);
+  // a code may only change once per report, so split the frame on repeats
+  for (size_t i = frame->start; i < frame->count; ++i)
+    if (frame->events[i].type == type && frame->events[i].code == code) {
+      frame_push(frame, EV_SYN, SYN_REPORT, 0);
+      frame->start = frame->count;
+      break;
+    }
+  frame_push(frame, type, code, value);
+}
+
+void frame_key(struct output_frame *frame, uint16_t code, bool pressed) {
+  if (pressed ? frame->held[code]++ == 0
+              : frame->held[code] && --frame->held[code] == 0)
+    frame_emit(frame, EV_KEY, code, pressed);
+}
+
+static const char *const curve_shape_names[] = {
+    [CURVE_EXPONENTIAL] = "exponential",
+    [CURVE_LINEAR] = "linear",
+    [CURVE_QUADRATIC] = "quadratic",
+    [CURVE_S] = "s-curve",
+};
+
+int parse_curve_shape(const char *name) {
+  for (size_t i = 0; i < sizeof(curve_shape_names) / sizeof(*curve_shape_names);
+       ++i)
+    if (strcmp(name, curve_shape_names[i]) == 0)
+      return (int)i;
+  return -1;
+}
+
+void build_curve(struct curve *curve, enum curve_shape shape, double base,
+                 int64_t div1, int64_t sub, int64_t div2, int64_t mul) {
+  const double max_gain =
+      pow(base, (double)(((CURVE_SIZE - 1) << CURVE_SHIFT) - sub) / div1) *
+      mul / div2;
+  for (int i = 0; i < CURVE_SIZE; ++i) {
+    const double x = (i + 0.5) / (CURVE_SIZE - 1);
+    switch (shape) {
+    case CURVE_EXPONENTIAL:
+      curve->gain[i] =
+          pow(base, (double)((i << CURVE_SHIFT) - sub) / div1) * mul / div2;
+      break;
+    case CURVE_LINEAR:
+      curve->gain[i] = max_gain;
+      break;
+    case CURVE_QUADRATIC:
+      curve->gain[i] = max_gain * x;
+      break;
+    case CURVE_S:
+      curve->gain[i] = max_gain * x * (3 - 2 * x);
+      break;
+    }
+  }
+}
+
+double curve_speed(const struct curve *curve, int value) {
+  const unsigned int i = (unsigned int)abs(value) >> CURVE_SHIFT;
+  return curve->gain[i < CURVE_SIZE ? i : CURVE_SIZE - 1] * value *
+         (1 << SUBPIXEL_SHIFT);
+}
+
+// a negative interval takes back motion that has been integrated past the time
+// an input actually changed
+void channels_integrate(struct channels *channels, int64_t interval) {
+  channels->motion += __builtin_convertvector(
+      channels->speed * (double)interval, channel_motion);
+}
+
+void channels_integrate_scalar(struct channels *channels, int64_t interval) {
+  for (int i = 0; i < CHANNELS; ++i)
+    channels->motion[i] += (int64_t)(channels->speed[i] * (double)interval);
+}
+
+// take out the whole part of the motion of a channel, keeping the remainder
+// for the next tick
+[[nodiscard]] static int take_whole(struct channels *channels,
+                                    enum channel channel) {
+  const int whole = (int)(channels->motion[channel] / (1 << SUBPIXEL_SHIFT));
+  channels->motion[channel] -= (int64_t)whole * (1 << SUBPIXEL_SHIFT);
+  return whole;
+}
+
+void calibrate_axis(struct axis_range *axis, int32_t minimum, int32_t maximum) {
+  const int64_t half = ((int64_t)maximum - minimum) / 2;
+  *axis = (struct axis_range){
+      .minimum = minimum,
+      .center = (int32_t)(((int64_t)minimum + maximum) / 2),
+      .scale = half > 0 ? (32767ll << 16) / half : 1 << 16};
+}
+
+void calibration_init(struct calibration *calibration) {
+  for (int i = 0; i < ABS_CNT; ++i)
+    calibrate_axis(&calibration->axes[i], -32768, 32767);
+}
+
+[[nodiscard]] static int clamp(int64_t value, int minimum, int maximum) {
+  return value < minimum ? minimum : value > maximum ? maximum : (int)value;
+}
+
+[[nodiscard]] static int scale_stick(const struct axis_range *axis,
+                                     int32_t value) {
+  return clamp(((int64_t)value - axis->center) * axis->scale >> 16, -32767,
+               32767);
+}
+
+[[nodiscard]] static int scale_trigger(const struct axis_range *axis,
+                                       int32_t value) {
+  return clamp(((int64_t)value - axis->minimum) * axis->scale >> 17, 0, 32767);
+}
+
+// the deadzone is a circle of noise_factor times the noise floor around the
+// resting position, but at least min_deadzone and at most max_deadzone
+static const int min_deadzone = 1 << 11, max_deadzone = 1 << 13,
+                 noise_factor = 4;
+// the resting position cannot move further than max_rest from the center, well
+// within the smallest deadzone, nor the noise floor above what makes the
+// largest one
+static const int max_rest = 1 << 9, max_noise = max_deadzone / noise_factor;
+// the noise floor is kept in 1 / (1 << NOISE_SHIFT) units, so that it moves by
+// less than a unit per reading
+#define NOISE_SHIFT 12
+
+void core_init(struct core *core, const struct config *config,
+               const struct calibration *calibration, bool event_timing,
+               int64_t time) {
+  *core = (struct core){.config = config,
+                        .calibration = *calibration,
+                        .event_timing = event_timing,
+                        .lstick.curve = &config->lcurve,
+                        .rstick.curve = &config->rcurve,
+                        .last_time = time,
+                        .motion_time = time};
+  // a cached calibration may predate the limits
+  for (int i = 0; i < ABS_CNT; ++i) {
+    struct axis_range *range = &core->calibration.axes[i];
+    range->rest = clamp(range->rest, -max_rest, max_rest);
+    range->noise = clamp(range->noise, 0, max_noise << NOISE_SHIFT);
+  }
+}
+
+void core_init_motion(struct core *core, const struct config *config,
+                      int resolution, bool event_timing, int64_t time) {
+  struct calibration calibration;
+  calibration_init(&calibration);
+  core_init(core, config, &calibration, event_timing, time);
+  core->gyro_resolution = resolution;
+}
+
+// track the resting position and noise floor of an axis of the stick while
+// the stick is within the deadzone, so a deflection held outside of it is
+// never taken for drift, and update the stick from its position
+static void move_axis(struct stick *stick, int axis, struct axis_range *range,
+                      int value) {
+  const int offset = value - range->rest;
+  stick->raw[axis] = offset;
+  stick->noise[axis] = range->noise >> NOISE_SHIFT;
+
+  const int noise =
+      stick->noise[0] > stick->noise[1] ? stick->noise[0] : stick->noise[1];
+  const double deadzone = clamp((int64_t)noise * noise_factor, min_deadzone,
+                                max_deadzone);
+  const double x = stick->raw[0], y = stick->raw[1];
+  const double radius = sqrt(x * x + y * y);
+  if (radius <= deadzone) {
+    // a unit per reading, so the resting position settles on the median of
+    // the readings rather than following a deflection
+    range->rest = clamp(range->rest + (offset > 0) - (offset < 0), -max_rest,
+                        max_rest);
+    // the noise floor falls faster than it rises, settling at about a third
+    // of the jitter, so the stick passing through the center hardly widens
+    // the deadzone
+    const int deviation = (abs(offset) << NOISE_SHIFT) - range->noise;
+    range->noise =
+        clamp(range->noise + deviation / (deviation > 0 ? 2048 : 512), 0,
+              max_noise << NOISE_SHIFT);
+    stick->x = stick->y = 0;
+    return;
+  }
+  // scale what is left so motion starts from zero at the edge of the deadzone
+  const double k = (radius - deadzone) / (32767 - deadzone) * 32767 / radius;
+  stick->x = clamp((int64_t)(x * k), -32767, 32767);
+  stick->y = clamp((int64_t)(y * k), -32767, 32767);
+}
+
+// look the speed of every channel up after any of its inputs has changed, so
+// integrating them is just a multiplication; the pointer is slowed down and the
+// wheel pushed on by the triggers
+static void update_speeds(struct core *core) {
+  const double pointer = (32767 - core->slowdown) / 32767.0;
+  channel_speeds *speed = &core->channels.speed;
+  (*speed)[CHANNEL_LEFT_X] =
+      curve_speed(core->lstick.curve, core->lstick.x) * pointer;
+  (*speed)[CHANNEL_LEFT_Y] =
+      curve_speed(core->lstick.curve, core->lstick.y) * pointer;
+  (*speed)[CHANNEL_RIGHT_X] = curve_speed(core->rstick.curve, core->rstick.x);
+  (*speed)[CHANNEL_RIGHT_Y] = curve_speed(core->rstick.curve, core->rstick.y);
+  (*speed)[CHANNEL_SCROLL] = curve_speed(core->rstick.curve, core->scroll);
+  if (core->gyro_resolution) {
+    // turning right and tilting up yaw and pitch negatively
+    const double gyro = pointer * (1 << SUBPIXEL_SHIFT) / 1e9 /
+                        core->gyro_resolution;
+    (*speed)[CHANNEL_GYRO_X] =
+        -core->gyro[0] * gyro * core->config->gyro_yaw;
+    (*speed)[CHANNEL_GYRO_Y] =
+        -core->gyro[1] * gyro * core->config->gyro_pitch;
+  }
+}
+
+// integrate the motion up to time, extrapolating it further up to lead past
+// it; extrapolated motion is taken back once the position turns out to have
+// changed within it
+static void advance(struct core *core, int64_t time, int64_t lead) {
+  channels_integrate(&core->channels, time + lead - core->motion_time);
+  core->motion_time = time + lead;
+  core->last_time = time;
+}
+
+// trigger positions are dragged down to the strongest precision trigger and
+// summed up over the scroll triggers
+static void update_triggers(struct core *core) {
+  const struct mapping *mapping = &core->config->mapping;
+  int scroll = 0;
+  core->slowdown = 0;
+  for (int i = 0; i < ABS_CNT; ++i) {
+    const int effect = core->axes[i] * mapping->axes[i].percent[0] / 100;
+    switch (mapping->axes[i].role) {
+    case AXIS_PRECISION:
+      if (core->axes[i] - effect > core->slowdown)
+        core->slowdown = core->axes[i] - effect;
+      break;
+    case AXIS_SCROLL_UP:
+      scroll += effect;
+      break;
+    case AXIS_SCROLL_DOWN:
+      scroll -= effect;
+      break;
+    }
+  }
+  core->scroll = clamp(scroll, -32767, 32767);
+  update_speeds(core);
+}
+
+static void emit_chord(struct output_frame *frame, const struct chord *chord,
+                       bool pressed) {
+  for (unsigned int i = 0; i < chord->count; ++i)
+    frame_key(frame, chord->codes[i], pressed);
+}
+
+// press or release what a binding holds; tap/hold bindings only get here once
+// held
+static void hold_binding(struct core *core, unsigned int index, bool pressed,
+                         struct output_frame *frame) {
+  const struct mapping *mapping = &core->config->mapping;
+  const struct binding *binding = &mapping->bindings[index];
+  if (binding->layer)
+    core->layers[binding->layer] += pressed ? 1 : -1;
+  emit_chord(frame,
+             &mapping->chords[binding->tap_hold ? binding->hold_chord
+                                                : binding->chord],
+             pressed);
+}
+
+// what a binding does on a short press
+static void tap_binding(struct core *core, unsigned int index,
+                        struct output_frame *frame) {
+  const struct mapping *mapping = &core->config->mapping;
+  const struct binding *binding = &mapping->bindings[index];
+  if (binding->tap_hold) {
+    emit_chord(frame, &mapping->chords[binding->chord], true);
+    emit_chord(frame, &mapping->chords[binding->chord], false);
+  } else {
+    hold_binding(core, index, true, frame);
+    hold_binding(core, index, false, frame);
+  }
+}
+
+// when an input happened, on the clock core_tick() is given
+[[nodiscard]] static int64_t input_time(const struct core *core,
+                                        const struct input_event *ev) {
+  return core->event_timing ? event_time(ev) : get_time();
+}
+
+static void start_repeat(struct core *core, unsigned int source,
+                         unsigned int chord, int64_t time) {
+  if (core->config->repeat_delay == 0 || chord == 0)
+    return;
+  core->repeat_source = (uint16_t)source;
+  core->repeat_chord = (uint8_t)chord;
+  core->repeat_start = core->repeat_next =
+      time + core->config->repeat_delay * 1'000'000ll;
+}
+
+static void stop_repeat(struct core *core, unsigned int source) {
+  if (core->repeat_source == source)
+    core->repeat_source = 0;
+}
+
+// tap the last key of the repeating chord again once it is due; repeats
+// missed by a late tick are skipped rather than bunched up
+static void repeat(struct core *core, int64_t time,
+                   struct output_frame *frame) {
+  if (!core->repeat_source || time < core->repeat_next)
+    return;
+  const struct config *config = core->config;
+  const struct chord *chord = &config->mapping.chords[core->repeat_chord];
+  // the key is tapped only while nothing else holds it, as releasing it in
+  // between would release it under the other holder
+  const uint16_t code = chord->codes[chord->count - 1];
+  if (frame->held[code] == 1) {
+    frame_emit(frame, EV_KEY, code, 0);
+    frame_emit(frame, EV_KEY, code, 1);
+  }
+  while (core->repeat_next <= time) {
+    const double ramp =
+        config->repeat_ramp
+            ? fmin((double)(core->repeat_next - core->repeat_start) /
+                       (config->repeat_ramp * 1e6),
+                   1)
+            : 1;
+    const double rate = config->repeat_rate +
+                        (config->repeat_max_rate - config->repeat_rate) * ramp;
+    core->repeat_next += (int64_t)(1e9 / rate);
+  }
+}
+
+// hold the binding of a button pressed at time, repeating D-pad buttons
+static void hold_button(struct core *core, uint16_t code, uint8_t index,
+                        int64_t time, struct output_frame *frame) {
+  const struct binding *binding = &core->config->mapping.bindings[index];
+  core->bindings[code] = index;
+  hold_binding(core, index, true, frame);
+  if (code >= BTN_DPAD_UP && code <= BTN_DPAD_RIGHT && !binding->tap_hold)
+    start_repeat(core, code, binding->chord, time);
+}
+
+[[nodiscard]] static int64_t pending_deadline(const struct core *core) {
+  const int time =
+      core->pending_combo ? core->config->combo_time : core->config->tap_time;
+  return core->pending_time + time * 1'000'000ll;
+}
+
+// hold the binding of the pending button, which has been held for its time
+// or interrupted by another press; a tap/hold button that could have been
+// part of a combo goes on to wait for its tap time unless interrupted
+static void settle(struct core *core, bool interrupted,
+                   struct output_frame *frame) {
+  if (core->pending_combo) {
+    core->pending_combo = false;
+    if (core->config->mapping.bindings[core->pending_binding].tap_hold &&
+        !interrupted)
+      return;
+  }
+  hold_button(core, core->pending, core->pending_binding, core->pending_time,
+              frame);
+  core->pending = 0;
+}
+
+static void press_button(struct core *core, uint16_t code, int64_t time,
+                         struct output_frame *frame) {
+  const struct mapping *mapping = &core->config->mapping;
+  if (core->pending) {
+    const uint16_t combos =
+        core->pending_combo
+            ? mapping->combos[core->pending] & mapping->combos[code]
+            : 0;
+    if (combos) {
+      const int combo = __builtin_ctz(combos);
+      core->combos |= 1u << combo;
+      core->pending = 0;
+      hold_binding(core, mapping->combo_table[combo].binding, true, frame);
+      return;
+    }
+    settle(core, true, frame);
+  }
+
+  unsigned int layer = MAX_LAYERS - 1;
+  while (layer && !core->layers[layer])
+    --layer;
+  const uint8_t index = mapping->keys[layer][code] ? mapping->keys[layer][code]
+                                                   : mapping->keys[0][code];
+  if (mapping->combos[code] || mapping->bindings[index].tap_hold) {
+    core->pending = code;
+    core->pending_binding = index;
+    core->pending_combo = mapping->combos[code] != 0;
+    core->pending_time = time;
+    return;
+  }
+  hold_button(core, code, index, time, frame);
+}
+
+static void release_button(struct core *core, uint16_t code,
+                           struct output_frame *frame) {
+  const struct mapping *mapping = &core->config->mapping;
+  if (core->pending == code) {
+    core->pending = 0;
+    tap_binding(core, core->pending_binding, frame);
+    return;
+  }
+  // releasing either button of a combo releases it
+  const uint16_t combos = core->combos & mapping->combos[code];
+  for (uint16_t left = combos; left; left &= left - 1)
+    hold_binding(core, mapping->combo_table[__builtin_ctz(left)].binding,
+                 false, frame);
+  core->combos &= ~combos;
+  hold_binding(core, core->bindings[code], false, frame);
+  core->bindings[code] = 0;
+  stop_repeat(core, code);
+}
+
+void core_set_config(struct core *core, const struct config *config,
+                     bool event_timing, struct output_frame *frame) {
+  // a pending button has not done anything yet
+  const struct mapping *mapping = &core->config->mapping;
+  for (int i = 0; i < KEY_CNT / 64; ++i)
+    for (uint64_t keys = core->keys[i]; keys; keys &= keys - 1)
+      hold_binding(core, core->bindings[i * 64 + __builtin_ctzll(keys)], false,
+                   frame);
+  for (uint16_t combos = core->combos; combos; combos &= combos - 1)
+    hold_binding(core, mapping->combo_table[__builtin_ctz(combos)].binding,
+                 false, frame);
+  for (int i = 0; i < ABS_CNT; ++i)
+    if (core->axes[i])
+      emit_chord(frame,
+                 &mapping->chords[mapping->axes[i].chords[core->axes[i] > 0]],
+                 0);
+  memset(core->keys, 0, sizeof(core->keys));
+  memset(core->axes, 0, sizeof(core->axes));
+  memset(core->bindings, 0, sizeof(core->bindings));
+  memset(core->layers, 0, sizeof(core->layers));
+  core->combos = core->pending = core->repeat_source = 0;
+  core->momentum[0] = core->momentum[1] = 0;
+  core->slowdown = core->scroll = 0;
+
+  core->config = config;
+  core->event_timing = event_timing;
+  core->lstick.curve = &config->lcurve;
+  core->rstick.curve = &config->rcurve;
+  update_speeds(core);
+}
+
+// a motion sensor only moves the pointer by its gyro, ABS_RY yawing and ABS_RX
+// pitching
+static void move_gyro(struct core *core, const struct input_event *ev) {
+  if (ev->type != EV_ABS || (ev->code != ABS_RX && ev->code != ABS_RY))
+    return;
+  if (core->event_timing)
+    advance(core, event_time(ev), 0);
+  const int deadzone = core->config->gyro_deadzone * core->gyro_resolution;
+  core->gyro[ev->code == ABS_RX] = abs(ev->value) <= deadzone ? 0 : ev->value;
+  update_speeds(core);
+}
+
+void core_event(struct core *core, const struct input_event *ev,
+                struct output_frame *frame) {
+  if (core->gyro_resolution) {
+    move_gyro(core, ev);
+    return;
+  }
+  const struct mapping *mapping = &core->config->mapping;
+  const size_t pending = frame->count;
+  enum stats_class class = STATS_BUTTON;
+
+  if (ev->type == EV_KEY && ev->code < KEY_CNT) {
+    // autorepeats and presses already seen do not hold the output again
+    const uint64_t bit = 1ull << ev->code % 64;
+    uint64_t *const keys = &core->keys[ev->code / 64];
+    if (!(*keys & bit) != !ev->value) {
+      *keys ^= bit;
+      if (ev->value)
+        press_button(core, ev->code, input_time(core, ev), frame);
+      else
+        release_button(core, ev->code, frame);
+    }
+  } else if (ev->type == EV_ABS && ev->code < ABS_CNT) {
+    const struct axis_mapping *axis = &mapping->axes[ev->code];
+    // integrate up to any change of the motion
+    if (core->event_timing && axis->role != AXIS_UNMAPPED &&
+        axis->role != AXIS_HAT && axis->role != AXIS_TRIGGER)
+      advance(core, event_time(ev), 0);
+
+    struct axis_range *range = &core->calibration.axes[ev->code];
+    int *const state = &core->axes[ev->code];
+    int value;
+    switch (axis->role) {
+    case AXIS_LEFT_X:
+    case AXIS_LEFT_Y:
+    case AXIS_RIGHT_X:
+    case AXIS_RIGHT_Y:
+      move_axis(axis->role <= AXIS_LEFT_Y ? &core->lstick : &core->rstick,
+                (axis->role - AXIS_LEFT_X) % 2, range,
+                scale_stick(range, ev->value));
+      update_speeds(core);
+      break;
+    case AXIS_HAT:
+      class = STATS_HAT;
+      const int direction = (ev->value > 0) - (ev->value < 0);
+      if (*state && *state != direction) {
+        emit_chord(frame, &mapping->chords[axis->chords[*state > 0]], 0);
+        stop_repeat(core, KEY_CNT + ev->code);
+      }
+      if (direction && *state != direction) {
+        emit_chord(frame, &mapping->chords[axis->chords[direction > 0]], 1);
+        start_repeat(core, KEY_CNT + ev->code, axis->chords[direction > 0],
+                     input_time(core, ev));
+      }
+      *state = direction;
+      break;
+    case AXIS_TRIGGER:
+      class = STATS_TRIGGER;
+      value = scale_trigger(range, ev->value);
+      if ((value * 100 > axis->percent[0] * 32767 && !*state) ||
+          (value * 100 < axis->percent[1] * 32767 && *state)) {
+        *state = !*state;
+        emit_chord(frame, &mapping->chords[axis->chords[1]], *state);
+      }
+      break;
+    case AXIS_PRECISION:
+    case AXIS_SCROLL_UP:
+    case AXIS_SCROLL_DOWN:
+      *state = scale_trigger(range, ev->value);
+      update_triggers(core);
+      break;
+    }
+  }
+
+  if (frame->count != pending)
+    frame_mark(frame, class, event_time(ev));
+}
+
+// keep the wheel going at the speed of the right stick when it was released,
+// slowing down exponentially
+static void glide(struct core *core) {
+  struct stick *stick = &core->rstick;
+  const double tau = core->config->scroll_momentum * 1e6;
+  if (stick->x || stick->y) {
+    if (tau > 0) {
+      core->momentum[0] = curve_speed(stick->curve, stick->x);
+      core->momentum[1] = curve_speed(stick->curve, stick->y);
+    }
+  } else if (core->momentum[0] || core->momentum[1]) {
+    const double decay = exp(-(double)(core->last_time - core->momentum_time) /
+                             tau);
+    for (int i = 0; i < 2; ++i) {
+      core->channels.motion[CHANNEL_RIGHT_X + i] +=
+          (int64_t)(core->momentum[i] * tau * (1 - decay));
+      core->momentum[i] *= decay;
+    }
+    // stop once less than a unit is left to go
+    if ((fabs(core->momentum[0]) + fabs(core->momentum[1])) * tau <
+        1 << SUBPIXEL_SHIFT)
+      core->momentum[0] = core->momentum[1] = 0;
+  }
+  core->momentum_time = core->last_time;
+}
+
+// emit hi-res wheel motion, and a low-res step for every 120 of it
+static void emit_wheel(struct output_frame *frame, uint16_t hi_res_code,
+                       uint16_t code, int value, int *detents) {
+  frame_emit(frame, EV_REL, hi_res_code, value);
+  if ((*detents < 0) != (value < 0))
+    *detents = 0;
+  *detents += value;
+  const int steps = *detents / 120;
+  if (steps) {
+    frame_emit(frame, EV_REL, code, steps);
+    *detents -= steps * 120;
+  }
+}
+
+void core_tick(struct core *core, int64_t time, struct output_frame *frame) {
+  while (core->pending && time >= pending_deadline(core))
+    settle(core, false, frame);
+  repeat(core, time, frame);
+
+  // the frame is shown at the vblank frame_lead after the tick
+  const int64_t lead =
+      core->config->refresh_rate ? core->config->frame_lead * 1'000ll : 0;
+  if (!core->event_timing) {
+    // without event timestamps, the position after this wakeup's events is
+    // taken to have held since the previous wakeup
+    if (!core->moving)
+      core->motion_time = time + lead;
+    advance(core, time, lead);
+    core->moving = core_active(core);
+  } else if (time > core->last_time) {
+    advance(core, time, lead);
+  }
+
+  // the gyro moves the pointer along with the left stick, and the scroll
+  // triggers the wheel along with the right one
+  struct channels *channels = &core->channels;
+  channels->motion[CHANNEL_LEFT_X] += channels->motion[CHANNEL_GYRO_X];
+  channels->motion[CHANNEL_LEFT_Y] += channels->motion[CHANNEL_GYRO_Y];
+  channels->motion[CHANNEL_GYRO_X] = channels->motion[CHANNEL_GYRO_Y] = 0;
+  const int slx = take_whole(channels, CHANNEL_LEFT_X),
+            sly = take_whole(channels, CHANNEL_LEFT_Y);
+  if (slx || sly) {
+    frame_emit(frame, EV_REL, REL_X, slx);
+    frame_emit(frame, EV_REL, REL_Y, sly);
+    frame_mark(frame, STATS_STICK, core->last_time);
+  }
+
+  glide(core);
+  channels->motion[CHANNEL_RIGHT_Y] += channels->motion[CHANNEL_SCROLL];
+  channels->motion[CHANNEL_SCROLL] = 0;
+  const int srx = take_whole(channels, CHANNEL_RIGHT_X),
+            sry = take_whole(channels, CHANNEL_RIGHT_Y);
+  if (srx)
+    emit_wheel(frame, REL_HWHEEL_HI_RES, REL_HWHEEL, -srx, &core->detents[0]);
+  if (sry)
+    emit_wheel(frame, REL_WHEEL_HI_RES, REL_WHEEL, sry, &core->detents[1]);
+  if (srx || sry)
+    frame_mark(frame, STATS_STICK, core->last_time);
+}
+
+bool core_active(const struct core *core) {
+  return core->lstick.x || core->lstick.y || core->rstick.x ||
+         core->rstick.y || core->gyro[0] || core->gyro[1] ||
+         core->momentum[0] || core->momentum[1] ||
+         core->scroll || core->pending || core->repeat_source;
+}
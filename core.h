@@ -0,0 +1,259 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <linux/input.h>
+
+#include "stats.h"
+
+// the clock gamepad events are stamped with, see libevdev_set_clock_id()
+extern const clockid_t clock_id;
+
+[[nodiscard]] int64_t get_time(void);
+[[nodiscard]] int64_t event_time(const struct input_event *ev);
+
+// output events collected for one frame and written to fd at once; nothing is
+// written if fd is negative
+struct output_frame {
+  int fd;
+  // if set, takes the events of each frame instead of them being written to
+  // fd; they are only valid during the call
+  void (*sink)(void *data, const struct input_event *events, size_t count);
+  void *sink_data;
+  size_t count, start;
+  unsigned int writes;
+  uint64_t emitted;
+  // earliest timestamp of the input behind each class of pending output
+  int64_t input_time[STATS_CLASSES];
+  // how many inputs of all gamepads writing through the frame hold each
+  // output key
+  uint16_t held[KEY_CNT];
+  struct input_event events[64];
+};
+
+void frame_emit(struct output_frame *frame, uint16_t type, uint16_t code,
+                int32_t value);
+// press or release an output key on behalf of one input; only the first press
+// and the last release are emitted
+void frame_key(struct output_frame *frame, uint16_t code, bool pressed);
+void frame_mark(struct output_frame *frame, enum stats_class class,
+                int64_t time);
+void frame_flush(struct output_frame *frame);
+
+#define CURVE_SHIFT 9
+#define CURVE_SIZE ((1 << 15 >> CURVE_SHIFT) + 1)
+
+enum curve_shape { CURVE_EXPONENTIAL, CURVE_LINEAR, CURVE_QUADRATIC, CURVE_S };
+
+// gain per 1 << CURVE_SHIFT wide bucket of |axis|, in units per axis unit per
+// nanosecond
+struct curve {
+  double gain[CURVE_SIZE];
+};
+
+[[nodiscard]] int parse_curve_shape(const char *name);
+// the exponential shape is pow(base, (|v| - sub) / div1) * mul / div2; the
+// other shapes reach the same gain at full deflection
+void build_curve(struct curve *curve, enum curve_shape shape, double base,
+                 int64_t div1, int64_t sub, int64_t div2, int64_t mul);
+// speed of an axis at value, in 1 / (1 << SUBPIXEL_SHIFT) units per nanosecond
+[[nodiscard]] double curve_speed(const struct curve *curve, int value);
+
+struct stick {
+  const struct curve *curve;
+  // scaled position relative to the resting position, and the noise floor
+  // of each axis
+  int raw[2], noise[2];
+  // position after the deadzone
+  int x, y;
+};
+
+#define SUBPIXEL_SHIFT 16
+
+// analog inputs of a gamepad, each integrated into motion of its own
+enum channel {
+  CHANNEL_LEFT_X,
+  CHANNEL_LEFT_Y,
+  CHANNEL_RIGHT_X,
+  CHANNEL_RIGHT_Y,
+  // the scroll triggers, pushing the vertical wheel
+  CHANNEL_SCROLL,
+  // the gyro of a motion sensor, moving the pointer
+  CHANNEL_GYRO_X,
+  CHANNEL_GYRO_Y,
+};
+
+// lanes of a channel block, one of them spare
+#define CHANNELS 8
+
+typedef double channel_speeds __attribute__((vector_size(CHANNELS * 8)));
+typedef int64_t channel_motion __attribute__((vector_size(CHANNELS * 8)));
+
+// the channels structure-of-arrays, so all of them are integrated in one pass
+struct channels {
+  // speed in 1 / (1 << SUBPIXEL_SHIFT) units per nanosecond, looked up
+  // whenever an input changes
+  channel_speeds speed;
+  // motion in 1 / (1 << SUBPIXEL_SHIFT) units
+  channel_motion motion;
+};
+
+// integrate the motion of every channel over interval
+void channels_integrate(struct channels *channels, int64_t interval);
+// the same one channel at a time, the reference for the benchmarks
+void channels_integrate_scalar(struct channels *channels, int64_t interval);
+
+#define CHORD_SIZE 4
+
+// output keys pressed in order and released together
+struct chord {
+  uint8_t count;
+  uint16_t codes[CHORD_SIZE];
+};
+
+enum axis_role {
+  AXIS_UNMAPPED,
+  AXIS_LEFT_X,
+  AXIS_LEFT_Y,
+  AXIS_RIGHT_X,
+  AXIS_RIGHT_Y,
+  // chords[0] while negative, chords[1] while positive
+  AXIS_HAT,
+  // chords[1] while pressed
+  AXIS_TRIGGER,
+  // slows the pointer down the further it is pressed
+  AXIS_PRECISION,
+  // scrolls the wheel the faster the further it is pressed
+  AXIS_SCROLL_UP,
+  AXIS_SCROLL_DOWN,
+};
+
+struct axis_mapping {
+  uint8_t role;
+  uint8_t chords[2];
+  // trigger: travel it is pressed and released at; precision: pointer speed,
+  // and scroll: wheel speed at full travel, all in percent
+  uint8_t percent[2];
+};
+
+#define MAX_LAYERS 4
+#define MAX_COMBOS 16
+
+// what pressing an input does: hold a chord and a layer while pressed, or with
+// tap_hold, tap the chord on a short press and hold hold_chord and the layer
+// on a long one; binding 0 does nothing
+struct binding {
+  uint8_t chord, hold_chord, layer;
+  bool tap_hold;
+};
+
+// two inputs pressed together, doing the binding instead of their own
+struct combo {
+  uint16_t inputs[2];
+  uint8_t binding;
+};
+
+// input codes index into the binding table of each layer, with the inputs a
+// layer leaves unbound falling through to layer 0; bindings and axes index
+// into the chord table, chord 0 is empty
+struct mapping {
+  uint8_t keys[MAX_LAYERS][KEY_CNT];
+  struct axis_mapping axes[ABS_CNT];
+  // combos each input is part of
+  uint16_t combos[KEY_CNT];
+  unsigned int combo_count, binding_count, chord_count;
+  struct combo combo_table[MAX_COMBOS];
+  struct binding bindings[256];
+  struct chord chords[256];
+};
+
+// sticks are scaled onto ±32767 around the center of their range, triggers
+// onto 0..32767; hats are only looked at for their sign
+struct axis_range {
+  int32_t minimum, center;
+  // 32767 / half of the range, in 1 / (1 << 16) units
+  int64_t scale;
+  // scaled position a stick rests at, and how far it wanders around it in
+  // 1 / (1 << 12) units, measured while it is in use
+  int32_t rest, noise;
+};
+
+struct calibration {
+  struct axis_range axes[ABS_CNT];
+};
+
+void calibrate_axis(struct axis_range *axis, int32_t minimum, int32_t maximum);
+// every axis ranging over ±32767
+void calibration_init(struct calibration *calibration);
+
+struct config;
+
+// mapping and acceleration state of one gamepad; it does no I/O but through
+// the output frames handed to it
+struct core {
+  const struct config *config;
+  struct calibration calibration;
+  // integrate between event timestamps rather than between ticks
+  bool event_timing, moving;
+  // pressed buttons, and hat direction or trigger state of each axis
+  uint64_t keys[KEY_CNT / 64];
+  int axes[ABS_CNT];
+  // binding each pressed button holds, and how many bindings hold each layer
+  uint8_t bindings[KEY_CNT];
+  uint8_t layers[MAX_LAYERS];
+  // combos being held
+  uint16_t combos;
+  // a button pressed at pending_time that may still turn out to be part of a
+  // combo or, if it has a tap/hold binding, to be tapped; 0 for none
+  uint16_t pending;
+  uint8_t pending_binding;
+  bool pending_combo;
+  int64_t pending_time;
+  // the D-pad button, or KEY_CNT plus the hat axis, whose chord is repeated
+  // from repeat_start on, 0 for none, and when it is repeated next
+  uint16_t repeat_source;
+  uint8_t repeat_chord;
+  int64_t repeat_start, repeat_next;
+  struct stick lstick, rstick;
+  // angular velocity of yaw and pitch after the deadzone, if the core maps a
+  // motion sensor rather than a gamepad, in units of gyro_resolution
+  int gyro[2];
+  // units of the gyro per degree per second, 0 for a gamepad
+  int gyro_resolution;
+  struct channels channels;
+  // time of the inputs the motion reflects, and the time it has been
+  // integrated up to, which frame-aligned output extrapolates ahead of it
+  int64_t last_time, motion_time;
+  // wheel speed gliding on after the right stick is released, in
+  // 1 / (1 << SUBPIXEL_SHIFT) units per nanosecond, and when it was taken
+  double momentum[2];
+  int64_t momentum_time;
+  // hi-res wheel motion since the last low-res step of 120
+  int detents[2];
+  // how far the pointer is slowed down and how fast the scroll triggers
+  // deflect the wheel, out of 32767
+  int slowdown, scroll;
+};
+
+void core_init(struct core *core, const struct config *config,
+               const struct calibration *calibration, bool event_timing,
+               int64_t time);
+// take over a motion sensor rather than a gamepad, whose gyro has resolution
+// units per degree per second
+void core_init_motion(struct core *core, const struct config *config,
+                      int resolution, bool event_timing, int64_t time);
+// switch to another config between frames, releasing everything held
+void core_set_config(struct core *core, const struct config *config,
+                     bool event_timing, struct output_frame *frame);
+void core_event(struct core *core, const struct input_event *ev,
+                struct output_frame *frame);
+// integrate stick motion up to time, or with refresh_rate set extrapolate it up
+// to frame_lead past time, and emit it; with event timing a time not after the
+// last event only emits what has been integrated so far
+void core_tick(struct core *core, int64_t time, struct output_frame *frame);
+// whether any stick is deflected or the gyro turns, the wheel moves, or a
+// button waits to be decided on or repeats, i.e. core_tick() has to be called
+// regularly
+[[nodiscard]] bool core_active(const struct core *core);
@@ -0,0 +1,767 @@
+#include "engine.h"
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include <libevdev/libevdev.h>
+
+#include "config.h"
+#include "stats.h"
+#include "telemetry.h"
+#include "trace.h"
+
+// epoll tags, gamepads are tagged with their slot index
+enum { WATCH_WAKE = MAX_GAMEPADS, WATCH_TIMER };
+
+static_assert(MAX_GAMEPADS <= 32, "slots are kept in a uint32_t");
+
+[[nodiscard]] static bool queue_push(struct queue *queue,
+                                     const struct message *message) {
+  const size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  if (tail - atomic_load_explicit(&queue->head, memory_order_acquire) ==
+      QUEUE_SIZE)
+    return false;
+  queue->messages[tail % QUEUE_SIZE] = *message;
+  atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+[[nodiscard]] static bool queue_pop(struct queue *queue,
+                                    struct message *message) {
+  const size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  if (head == atomic_load_explicit(&queue->tail, memory_order_acquire))
+    return false;
+  *message = queue->messages[head % QUEUE_SIZE];
+  atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+  return true;
+}
+
+static void signal_fd(int fd) {
+  if (write(fd, &(uint64_t){1}, sizeof(uint64_t)) < 0 && errno != EAGAIN)
+    err(EXIT_FAILURE, "failed to write eventfd");
+}
+
+static void watch(int epoll_fd, int fd, uint64_t tag) {
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd,
+                &(struct epoll_event){.events = EPOLLIN, .data.u64 = tag}) < 0)
+    err(EXIT_FAILURE, "failed to watch fd");
+}
+
+// expire at first on clock_id and every period after it, or never if period
+// is 0
+static void arm_timer(int fd, int64_t first, int64_t period) {
+  const struct itimerspec spec = {
+      .it_interval = {period / 1'000'000'000, period % 1'000'000'000},
+      .it_value = {period ? first / 1'000'000'000 : 0,
+                   period ? first % 1'000'000'000 : 0}};
+  if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+    err(EXIT_FAILURE, "failed to arm timer");
+}
+
+// the first tick after time on the grid anchored at start-up, so that ticks
+// keep one phase across idle periods and stay in step with the vblanks
+// frame_lead is reckoned from
+[[nodiscard]] static int64_t next_tick(const struct engine *engine,
+                                       int64_t time) {
+  const int64_t period = engine->tick_period;
+  return engine->tick_origin +
+         ((time - engine->tick_origin) / period + 1) * period;
+}
+
+// with refresh_rate set, a frame per vblank
+[[nodiscard]] static int64_t tick_period(const struct config *config) {
+  return 1'000'000'000 /
+         (config->refresh_rate ? config->refresh_rate : config->tick_rate);
+}
+
+static void reply(struct engine *engine, const struct message *message) {
+  // there are at most a reply per slot and per queued config in flight
+  if (!queue_push(&engine->replies, message))
+    warnx("engine reply queue is full");
+  signal_fd(engine->notify_fd);
+}
+
+static void detach(struct engine *engine, unsigned int slot) {
+  struct gamepad *pad = &engine->pads[slot];
+  // release whatever the gamepad was holding
+  core_set_config(&pad->core, pad->core.config, pad->core.event_timing,
+                  &engine->frame);
+  epoll_ctl(engine->epoll_fd, EPOLL_CTL_DEL, pad->fd, nullptr);
+  engine->attached &= ~(1u << slot);
+}
+
+// whether a motion sensor and a gamepad are nodes of one device: they share
+// its id and its uniq or, without one, the physical path up to the last '/'
+[[nodiscard]] static bool same_device(const struct gamepad *sensor,
+                                      const struct gamepad *pad) {
+  const struct device_id *a = &sensor->id, *b = &pad->id;
+  if (pad->remote || a->bustype != b->bustype || a->vendor != b->vendor ||
+      a->product != b->product || a->version != b->version ||
+      strcmp(a->uniq, b->uniq) != 0)
+    return false;
+  if (a->uniq[0])
+    return true;
+  const char *x = libevdev_get_phys(sensor->dev),
+             *y = libevdev_get_phys(pad->dev);
+  if (x == nullptr || y == nullptr)
+    return false;
+  const char *end = strrchr(x, '/');
+  const size_t length = end ? (size_t)(end - x) : strlen(x);
+  return strncmp(x, y, length) == 0 && (y[length] == '\0' || y[length] == '/');
+}
+
+// the motion sensors of a gamepad are enabled and disabled along with it
+static void link_sensors(struct engine *engine, const struct gamepad *pad) {
+  for (uint32_t slots = engine->attached; slots; slots &= slots - 1) {
+    struct gamepad *sensor = &engine->pads[__builtin_ctz(slots)];
+    if (sensor->core.gyro_resolution && same_device(sensor, pad))
+      sensor->enabled = pad->enabled;
+  }
+}
+
+// a motion sensor taken over after its gamepad starts out as the gamepad is
+static void link_gamepad(struct engine *engine, struct gamepad *sensor) {
+  for (uint32_t slots = engine->attached; slots; slots &= slots - 1) {
+    const struct gamepad *pad = &engine->pads[__builtin_ctz(slots)];
+    if (!pad->core.gyro_resolution && same_device(sensor, pad))
+      sensor->enabled = pad->enabled;
+  }
+}
+
+static void handle_command(struct engine *engine, const struct message *message,
+                           int64_t current_time) {
+  switch (message->type) {
+  case ENGINE_ADD: {
+    struct gamepad *pad = &engine->pads[message->slot];
+    if (pad->core.gyro_resolution)
+      link_gamepad(engine, pad);
+    else if (!pad->remote)
+      link_sensors(engine, pad);
+    engine->attached |= 1u << message->slot;
+#ifdef HAVE_LIBURING
+    if (engine->uring) {
+      pad->dropped = false;
+      engine->rearm |= 1u << message->slot;
+      break;
+    }
+#endif
+    watch(engine->epoll_fd, pad->fd, message->slot);
+    break;
+  }
+  case ENGINE_CONFIG: {
+    const struct config *config = message->config;
+    for (uint32_t slots = engine->attached; slots; slots &= slots - 1) {
+      struct gamepad *pad = &engine->pads[__builtin_ctz(slots)];
+      core_set_config(&pad->core, config,
+                      config->event_timing && pad->clock_set, &engine->frame);
+    }
+    const int64_t period = tick_period(config);
+    const bool rearm = engine->ticking && period != engine->tick_period;
+    engine->tick_period = period;
+    if (rearm) {
+      engine->next_deadline = next_tick(engine, current_time);
+      arm_timer(engine->timer_fd, engine->next_deadline, period);
+    }
+    reply(engine, &(struct message){.type = ENGINE_RETIRED,
+                                    .config = engine->config});
+    engine->config = config;
+    break;
+  }
+  case ENGINE_STOP:
+    for (uint32_t slots = engine->attached; slots; slots &= slots - 1)
+      detach(engine, (unsigned int)__builtin_ctz(slots));
+    if (engine->ticking)
+      arm_timer(engine->timer_fd, 0, 0);
+    engine->stopped = true;
+    break;
+  default:
+    break;
+  }
+}
+
+static void handle_event(struct engine *engine, struct gamepad *pad,
+                         const struct input_event *ev) {
+  if (engine->trace)
+    trace_write(engine->trace, (unsigned int)(pad - engine->pads), ev);
+
+  if (ev->type == EV_KEY && ev->code == BTN_MODE && ev->value == 0 &&
+      !pad->remote) {
+    const int rc = libevdev_grab(pad->dev, ((pad->enabled = !pad->enabled))
+                                               ? LIBEVDEV_GRAB
+                                               : LIBEVDEV_UNGRAB);
+    if (rc < 0) {
+      errno = -rc;
+      warn("failed to grab the gamepad");
+    }
+    link_sensors(engine, pad);
+  }
+  if (pad->enabled)
+    core_event(&pad->core, ev, &engine->frame);
+}
+
+// feed all pending events of a gamepad to its core; returns false if the
+// gamepad has gone away
+[[nodiscard]] static bool drain_gamepad(struct engine *engine,
+                                        struct gamepad *pad, uint64_t *events) {
+  unsigned int flags = LIBEVDEV_READ_FLAG_NORMAL;
+  while (true) {
+    struct input_event ev;
+    const int rc = libevdev_next_event(pad->dev, flags, &ev);
+    if (rc == -EAGAIN) {
+      if (flags == LIBEVDEV_READ_FLAG_SYNC) {
+        flags = LIBEVDEV_READ_FLAG_NORMAL;
+        continue;
+      }
+      return true;
+    }
+    if (rc < 0) {
+      if (rc == -ENODEV)
+        return false;
+      errno = -rc;
+      err(EXIT_FAILURE, "failed to read event");
+    }
+    switch (rc) {
+    case LIBEVDEV_READ_STATUS_SUCCESS:
+      break;
+    case LIBEVDEV_READ_STATUS_SYNC:
+      if (flags == LIBEVDEV_READ_FLAG_NORMAL) {
+        warnx("some events have been dropped by kernel");
+        stats_count(&stats->sync_drops, 1);
+        flags = LIBEVDEV_READ_FLAG_SYNC;
+        continue;
+      }
+      break;
+    default:
+      warnx("libevdev_next_event returned unknown error");
+      break;
+    }
+    ++*events;
+    handle_event(engine, pad, &ev);
+  }
+}
+
+// feed a batch a remote gamepad has sent, in place; it is stamped on arrival,
+// as the clock of the sender may be any
+static void handle_batch(struct engine *engine, struct gamepad *pad,
+                         struct input_event *batch, size_t count,
+                         uint64_t *events) {
+  const int64_t time = get_time();
+  for (size_t i = 0; i < count; ++i) {
+    struct input_event *ev = &batch[i];
+    // there is no state to read back
+    if (ev->type == EV_SYN && ev->code == SYN_DROPPED)
+      continue;
+    ev->input_event_sec = time / 1'000'000'000;
+    ev->input_event_usec = time % 1'000'000'000 / 1'000;
+    ++*events;
+    handle_event(engine, pad, ev);
+  }
+}
+
+// whether a message received with MSG_TRUNC, which reads as its whole length
+// even if it did not fit, is a batch of whole events that fitted; a sender
+// breaking that is dropped rather than having part of a batch mapped
+[[nodiscard]] static bool check_batch(const struct gamepad *pad, size_t size,
+                                      size_t capacity) {
+  if (size > capacity)
+    warnx("remote gamepad %s sent more than %zu events at once",
+          libevdev_get_name(pad->dev), capacity / sizeof(struct input_event));
+  else if (size % sizeof(struct input_event))
+    warnx("remote gamepad %s sent a partial event",
+          libevdev_get_name(pad->dev));
+  else
+    return true;
+  return false;
+}
+
+// receive every batch a remote gamepad has sent straight into the buffer the
+// core reads; returns false once the sender has gone away or is dropped
+[[nodiscard]] static bool drain_socket(struct engine *engine,
+                                       struct gamepad *pad, uint64_t *events) {
+  while (true) {
+    struct input_event batch[64];
+    const ssize_t size =
+        recv(pad->fd, batch, sizeof(batch), MSG_DONTWAIT | MSG_TRUNC);
+    if (size < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN)
+        return true;
+      warn("failed to read remote gamepad");
+      return false;
+    }
+    if (size == 0 || !check_batch(pad, (size_t)size, sizeof(batch)))
+      return false;
+    handle_batch(engine, pad, batch, (size_t)size / sizeof(*batch), events);
+  }
+}
+
+static void handle_commands(struct engine *engine, int64_t current_time) {
+  for (struct message message; queue_pop(&engine->commands, &message);)
+    handle_command(engine, &message, current_time);
+}
+
+// returns the time to integrate up to
+[[nodiscard]] static int64_t handle_timer(struct engine *engine,
+                                          uint64_t expirations,
+                                          int64_t current_time) {
+  // integrate up to the tick deadline rather than the wakeup time
+  engine->next_deadline += (int64_t)expirations * engine->tick_period;
+  const int64_t tick_time = engine->next_deadline - engine->tick_period;
+  return tick_time < current_time ? tick_time : current_time;
+}
+
+static void handle_disconnect(struct engine *engine, unsigned int slot) {
+  warnx("gamepad disconnected: %s", libevdev_get_name(engine->pads[slot].dev));
+  detach(engine, slot);
+  reply(engine, &(struct message){.type = ENGINE_REMOVED, .slot = slot});
+}
+
+// tick the cores and write the frame at the end of a wakeup
+static void finish_wakeup(struct engine *engine, int64_t current_time,
+                          int64_t tick_time, uint64_t events,
+                          uint64_t syscalls) {
+  struct output_frame *frame = &engine->frame;
+  bool active = false;
+  for (uint32_t slots = engine->attached; slots; slots &= slots - 1) {
+    const unsigned int slot = (unsigned int)__builtin_ctz(slots);
+    struct core *core = &engine->pads[slot].core;
+    core_tick(core, core->event_timing ? tick_time : current_time, frame);
+    active |= core_active(core);
+    telemetry_update(slot, &engine->pads[slot]);
+  }
+  frame_flush(frame);
+  telemetry_set_tick_rate(
+      active ? (int)(1'000'000'000 / engine->tick_period) : 0);
+
+  if (engine->ticking != active && !engine->stopped) {
+    ++syscalls;
+    engine->next_deadline = next_tick(engine, current_time);
+    arm_timer(engine->timer_fd, engine->next_deadline,
+              (engine->ticking = active) ? engine->tick_period : 0);
+  }
+
+  syscalls += frame->writes;
+  frame->writes = 0;
+  stats_count(&stats->wakeups, 1);
+  stats_count(&stats->events, events);
+  stats_count(&stats->syscalls, syscalls);
+  stats_record(&stats->events_per_wakeup, events);
+  stats_record(&stats->syscalls_per_wakeup, syscalls);
+}
+
+[[nodiscard]] static bool poll_epoll(struct engine *engine, int timeout) {
+  struct epoll_event ready[MAX_GAMEPADS + 2];
+  const int count =
+      epoll_wait(engine->epoll_fd, ready, MAX_GAMEPADS + 2, timeout);
+  if (count < 0 && errno != EINTR)
+    err(EXIT_FAILURE, "epoll_wait failed");
+  if (count <= 0)
+    return !engine->stopped;
+
+  const int64_t current_time = get_time();
+  // with event timing, only timer wakeups integrate past the last event
+  int64_t tick_time = 0;
+  // libevdev refills its queue with one read() per drain, mostly
+  uint64_t events = 0, syscalls = 1;
+
+  for (int i = 0; i < count; ++i)
+    switch (ready[i].data.u64) {
+    case WATCH_WAKE: {
+      ++syscalls;
+      uint64_t wakes;
+      if (read(engine->wake_fd, &wakes, sizeof(wakes)) < 0 && errno != EAGAIN)
+        err(EXIT_FAILURE, "failed to read eventfd");
+      handle_commands(engine, current_time);
+      break;
+    }
+    case WATCH_TIMER: {
+      ++syscalls;
+      uint64_t expirations;
+      if (read(engine->timer_fd, &expirations, sizeof(expirations)) < 0) {
+        if (errno != EAGAIN)
+          err(EXIT_FAILURE, "failed to read timerfd");
+      } else {
+        tick_time = handle_timer(engine, expirations, current_time);
+      }
+      break;
+    }
+    default: {
+      const unsigned int slot = (unsigned int)ready[i].data.u64;
+      struct gamepad *pad = &engine->pads[slot];
+      ++syscalls;
+      if (engine->attached >> slot & 1 &&
+          !(pad->remote ? drain_socket : drain_gamepad)(engine, pad, &events))
+        handle_disconnect(engine, slot);
+      break;
+    }
+    }
+
+  finish_wakeup(engine, current_time, tick_time, events, syscalls);
+  return !engine->stopped;
+}
+
+#ifdef HAVE_LIBURING
+
+// user data of uinput writes, the others are tagged like with epoll
+enum { WATCH_WRITE = WATCH_TIMER + 1 };
+
+// stop linking writes before anything else is queued or submitted
+static void end_writes(struct engine *engine) {
+  if (engine->last_write) {
+    engine->last_write->flags &= ~IOSQE_IO_LINK;
+    engine->last_write = nullptr;
+  }
+}
+
+static void submit(struct engine *engine, bool wait) {
+  end_writes(engine);
+  const int rc = wait ? io_uring_submit_and_wait(&engine->ring, 1)
+                      : io_uring_submit(&engine->ring);
+  if (rc < 0 && rc != -EINTR) {
+    errno = -rc;
+    err(EXIT_FAILURE, "failed to submit to io_uring");
+  }
+}
+
+[[nodiscard]] static struct io_uring_sqe *get_sqe(struct engine *engine) {
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&engine->ring);
+  if (sqe == nullptr) {
+    // only a wakeup writing more frames than the ring holds gets here
+    submit(engine, false);
+    if ((sqe = io_uring_get_sqe(&engine->ring)) == nullptr)
+      errx(EXIT_FAILURE, "io_uring is full");
+  }
+  return sqe;
+}
+
+static void queue_read(struct engine *engine, int fd, void *buf, size_t size,
+                       uint64_t tag) {
+  end_writes(engine);
+  struct io_uring_sqe *sqe = get_sqe(engine);
+  io_uring_prep_read(sqe, fd, buf, (unsigned int)size, 0);
+  io_uring_sqe_set_data64(sqe, tag);
+}
+
+// with MSG_TRUNC, for check_batch()
+static void queue_recv(struct engine *engine, int fd, void *buf, size_t size,
+                       uint64_t tag) {
+  end_writes(engine);
+  struct io_uring_sqe *sqe = get_sqe(engine);
+  io_uring_prep_recv(sqe, fd, buf, size, MSG_TRUNC);
+  io_uring_sqe_set_data64(sqe, tag);
+}
+
+// queue the reads that have completed again
+static void queue_reads(struct engine *engine) {
+  if (engine->rearm_wake)
+    queue_read(engine, engine->wake_fd, &engine->wake_buf,
+               sizeof(engine->wake_buf), WATCH_WAKE);
+  if (engine->rearm_timer)
+    queue_read(engine, engine->timer_fd, &engine->timer_buf,
+               sizeof(engine->timer_buf), WATCH_TIMER);
+  engine->rearm_wake = engine->rearm_timer = false;
+  for (uint32_t slots = engine->rearm & engine->attached; slots;
+       slots &= slots - 1) {
+    const unsigned int slot = (unsigned int)__builtin_ctz(slots);
+    (engine->pads[slot].remote ? queue_recv : queue_read)(
+        engine, engine->pads[slot].fd, engine->reads[slot],
+        sizeof(engine->reads[slot]), slot);
+  }
+  engine->rearm = 0;
+}
+
+// frame sink, queueing a write of the frame to be submitted with the next
+// wait
+static void queue_write(void *data, const struct input_event *events,
+                        size_t count) {
+  struct engine *engine = data;
+  if (engine->writes_used + count >
+      sizeof(engine->writes) / sizeof(*engine->writes)) {
+    // the virtual device is nonblocking, so io_uring issues the queued writes
+    // inline while submitting rather than punting them to io-wq, where this
+    // write could overtake them
+    submit(engine, false);
+    if (write(engine->frame.fd, events, count * sizeof(*events)) < 0)
+      warn("failed to write events");
+    return;
+  }
+  struct input_event *buf = &engine->writes[engine->writes_used];
+  memcpy(buf, events, count * sizeof(*events));
+  engine->writes_used += count;
+  struct io_uring_sqe *sqe = get_sqe(engine);
+  io_uring_prep_write(sqe, engine->frame.fd, buf,
+                      (unsigned int)(count * sizeof(*events)), -1);
+  io_uring_sqe_set_data64(sqe, WATCH_WRITE);
+  if (engine->last_write)
+    engine->last_write->flags |= IOSQE_IO_LINK;
+  engine->last_write = sqe;
+  ++engine->writes_pending;
+}
+
+// after dropped events, read the current state back and feed what differs
+// from what the core has seen, stamped like libevdev does with the time of
+// SYN_DROPPED: the state read back is taken to have held since events went
+// missing, so the core neither integrates the stale stick positions over the
+// gap nor keeps motion it has integrated into it already
+static void resync(struct engine *engine, struct gamepad *pad,
+                   const struct input_event *stamp, uint64_t *events) {
+
+  uint8_t keys[KEY_CNT / 8] = {};
+  if (ioctl(pad->fd, EVIOCGKEY(sizeof(keys)), keys) < 0)
+    warn("failed to read back button state");
+  for (unsigned int code = 0; code < KEY_CNT; ++code) {
+    const int pressed = keys[code / 8] >> code % 8 & 1;
+    if (code == BTN_MODE ||
+        pressed == (int)(pad->core.keys[code / 64] >> code % 64 & 1))
+      continue;
+    struct input_event ev = *stamp;
+    ev.type = EV_KEY;
+    ev.code = (uint16_t)code;
+    ev.value = pressed;
+    ++*events;
+    handle_event(engine, pad, &ev);
+  }
+
+  const struct mapping *mapping = &pad->core.config->mapping;
+  for (unsigned int code = 0; code < ABS_CNT; ++code) {
+    struct input_absinfo info;
+    if (mapping->axes[code].role == AXIS_UNMAPPED ||
+        ioctl(pad->fd, EVIOCGABS(code), &info) < 0)
+      continue;
+    struct input_event ev = *stamp;
+    ev.type = EV_ABS;
+    ev.code = (uint16_t)code;
+    ev.value = info.value;
+    ++*events;
+    handle_event(engine, pad, &ev);
+  }
+}
+
+static void handle_reads(struct engine *engine, unsigned int slot, int res,
+                         uint64_t *events) {
+  struct gamepad *pad = &engine->pads[slot];
+  if (pad->remote) {
+    if (res == -EINTR || res == -EAGAIN || res == -ECANCELED) {
+      engine->rearm |= 1u << slot;
+    } else if (res <= 0) {
+      // the sender closing the connection reads as an empty message
+      if (res < 0 && res != -ECONNRESET) {
+        errno = -res;
+        warn("failed to read remote gamepad");
+      }
+      handle_disconnect(engine, slot);
+    } else if (!check_batch(pad, (size_t)res, sizeof(engine->reads[slot]))) {
+      handle_disconnect(engine, slot);
+    } else {
+      engine->rearm |= 1u << slot;
+      handle_batch(engine, pad, engine->reads[slot],
+                   (size_t)res / sizeof(struct input_event), events);
+    }
+    return;
+  }
+  if (res == -ENODEV) {
+    handle_disconnect(engine, slot);
+    return;
+  }
+  engine->rearm |= 1u << slot;
+  if (res < 0) {
+    if (res == -EINTR || res == -EAGAIN || res == -ECANCELED)
+      return;
+    errno = -res;
+    err(EXIT_FAILURE, "failed to read event");
+  }
+  for (size_t i = 0; i < (size_t)res / sizeof(struct input_event); ++i) {
+    const struct input_event *ev = &engine->reads[slot][i];
+    if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+      warnx("some events have been dropped by kernel");
+      stats_count(&stats->sync_drops, 1);
+      pad->dropped = true;
+      pad->drop = (struct input_event){.input_event_sec = ev->input_event_sec,
+                                       .input_event_usec =
+                                           ev->input_event_usec};
+    } else if (pad->dropped) {
+      // what is left of the dropped report is stale
+      if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+        pad->dropped = false;
+        resync(engine, pad, &pad->drop, events);
+      }
+    } else {
+      ++*events;
+      handle_event(engine, pad, ev);
+    }
+  }
+}
+
+[[nodiscard]] static bool poll_uring(struct engine *engine, int timeout) {
+  queue_reads(engine);
+  submit(engine, timeout != 0);
+
+  const int64_t current_time = get_time();
+  int64_t tick_time = 0;
+  uint64_t events = 0, syscalls = 1;
+  bool woken = false;
+
+  unsigned int head, count = 0;
+  struct io_uring_cqe *cqe;
+  io_uring_for_each_cqe(&engine->ring, head, cqe) {
+    ++count;
+    const uint64_t tag = io_uring_cqe_get_data64(cqe);
+    switch (tag) {
+    case WATCH_WAKE:
+      engine->rearm_wake = true;
+      woken = true;
+      break;
+    case WATCH_TIMER:
+      engine->rearm_timer = true;
+      if (cqe->res == sizeof(engine->timer_buf))
+        tick_time = handle_timer(engine, engine->timer_buf, current_time);
+      break;
+    case WATCH_WRITE:
+      if (cqe->res < 0) {
+        errno = -cqe->res;
+        warn("failed to write events");
+      }
+      if (--engine->writes_pending == 0)
+        engine->writes_used = 0;
+      break;
+    default:
+      if (engine->attached >> tag & 1)
+        handle_reads(engine, (unsigned int)tag, cqe->res, &events);
+      break;
+    }
+  }
+  io_uring_cq_advance(&engine->ring, count);
+  if (count == 0)
+    return !engine->stopped;
+  // commands are handled after the reads, a gamepad added meanwhile has
+  // nothing to read yet
+  if (woken)
+    handle_commands(engine, current_time);
+
+  finish_wakeup(engine, current_time, tick_time, events, syscalls);
+  if (engine->stopped) {
+    // the ring goes away with the engine, the last writes must not
+    submit(engine, false);
+    while (engine->writes_pending) {
+      if (io_uring_wait_cqe(&engine->ring, &cqe) < 0)
+        break;
+      if (io_uring_cqe_get_data64(cqe) == WATCH_WRITE)
+        --engine->writes_pending;
+      io_uring_cqe_seen(&engine->ring, cqe);
+    }
+  } else if (!engine->threaded) {
+    // nested in another loop, nothing would submit until the next wakeup
+    queue_reads(engine);
+    submit(engine, false);
+  }
+  return !engine->stopped;
+}
+
+#endif
+
+void engine_init(struct engine *engine, struct gamepad pads[],
+                 const struct config *config, int uinput_fd, FILE *trace,
+                 bool threaded) {
+  *engine = (struct engine){
+      .pads = pads,
+      .config = config,
+      .trace = trace,
+      .threaded = threaded,
+      .epoll_fd = epoll_create1(0),
+      .timer_fd = timerfd_create(clock_id, TFD_NONBLOCK),
+      .wake_fd = eventfd(0, EFD_NONBLOCK),
+      .notify_fd = eventfd(0, EFD_NONBLOCK),
+      .frame.fd = uinput_fd,
+      .tick_period = tick_period(config),
+      .tick_origin = get_time()};
+  if (engine->epoll_fd < 0 || engine->timer_fd < 0 || engine->wake_fd < 0 ||
+      engine->notify_fd < 0)
+    err(EXIT_FAILURE, "failed to create engine");
+  watch(engine->epoll_fd, engine->wake_fd, WATCH_WAKE);
+  watch(engine->epoll_fd, engine->timer_fd, WATCH_TIMER);
+
+#ifdef HAVE_LIBURING
+  // room for every read and a busy wakeup worth of writes
+  const int rc = io_uring_queue_init(64, &engine->ring, 0);
+  if (rc < 0) {
+    errno = -rc;
+    warn("io_uring is not available, polling instead");
+    return;
+  }
+  engine->uring = true;
+  // uinput never has a write wait, but a blocking fd has io_uring punt every
+  // write to io-wq, where writes of different submissions may be reordered
+  const int flags = fcntl(uinput_fd, F_GETFL);
+  if (flags < 0 || fcntl(uinput_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    warn("failed to make the virtual device nonblocking");
+  engine->rearm_wake = engine->rearm_timer = true;
+  engine->frame.sink = queue_write;
+  engine->frame.sink_data = engine;
+  if (!threaded) {
+    // the ring fd only becomes readable once there is something to complete
+    queue_reads(engine);
+    submit(engine, false);
+  }
+#endif
+}
+
+void engine_destroy(struct engine *engine) {
+#ifdef HAVE_LIBURING
+  // cancels the reads still pending on the gamepads
+  if (engine->uring)
+    io_uring_queue_exit(&engine->ring);
+#endif
+  close(engine->epoll_fd);
+  close(engine->timer_fd);
+  close(engine->wake_fd);
+  close(engine->notify_fd);
+}
+
+int engine_fd(const struct engine *engine) {
+#ifdef HAVE_LIBURING
+  if (engine->uring)
+    return engine->ring.ring_fd;
+#endif
+  return engine->epoll_fd;
+}
+
+bool engine_poll(struct engine *engine, int timeout) {
+#ifdef HAVE_LIBURING
+  if (engine->uring)
+    return poll_uring(engine, timeout);
+#endif
+  return poll_epoll(engine, timeout);
+}
+
+void *engine_run(void *engine) {
+  while (engine_poll(engine, -1))
+    ;
+  return nullptr;
+}
+
+void engine_send(struct engine *engine, const struct message *message) {
+  // the engine empties the queue on every wakeup, so it is hardly ever full
+  while (!queue_push(&engine->commands, message))
+    if (engine->threaded)
+      sched_yield();
+    else
+      (void)engine_poll(engine, 0);
+  signal_fd(engine->wake_fd);
+}
+
+bool engine_receive(struct engine *engine, struct message *message) {
+  return queue_pop(&engine->replies, message);
+}
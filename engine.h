@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "cache.h"
+#include "core.h"
+
+#define MAX_GAMEPADS 8
+
+struct gamepad {
+  // nullptr if the slot is free
+  struct libevdev *dev;
+  int fd;
+  // number of the evdev node
+  int node;
+  // toggled by BTN_MODE
+  bool enabled;
+  // fed through the injection socket rather than an evdev node: fd is the
+  // connection, each message of which is a batch of events, and dev only
+  // holds the name
+  bool remote;
+  // whether events are stamped with clock_id, needed for event timing
+  bool clock_set;
+  // events are being dropped until the next SYN_REPORT, after which the state
+  // is read back from the kernel and stamped with the time of the
+  // SYN_DROPPED in drop; only the io_uring backend does this itself
+  bool dropped;
+  struct input_event drop;
+  struct device_id id;
+  struct core core;
+};
+
+enum message_type {
+  // control to engine: take over the gamepad in slot
+  ENGINE_ADD,
+  // control to engine: switch to config
+  ENGINE_CONFIG,
+  // control to engine: release everything and stop
+  ENGINE_STOP,
+  // engine to control: the gamepad in slot has gone away and is handed back
+  ENGINE_REMOVED,
+  // engine to control: config is no longer used
+  ENGINE_RETIRED,
+};
+
+struct message {
+  enum message_type type;
+  unsigned int slot;
+  const struct config *config;
+};
+
+#define QUEUE_SIZE 64
+
+// lock-free, for one producer and one consumer thread
+struct queue {
+  alignas(64) atomic_size_t head;
+  alignas(64) atomic_size_t tail;
+  struct message messages[QUEUE_SIZE];
+};
+
+// reads the gamepads, maps them and writes the virtual device; nothing is
+// allocated once it runs, so it can run on a real-time thread while hotplug
+// and config reload run on another one, talking to it through the queues
+struct engine {
+  struct gamepad *pads;
+  // slots owned by the engine, the others belong to the control side
+  uint32_t attached;
+  const struct config *config;
+  FILE *trace;
+  // whether the engine has a thread of its own
+  bool threaded, stopped;
+  // gamepads, timer_fd and wake_fd; can itself be polled for readiness
+  int epoll_fd;
+  int timer_fd;
+  // wake_fd is signalled when commands are queued, notify_fd when replies
+  int wake_fd, notify_fd;
+  struct queue commands, replies;
+  // outputs of all gamepads are merged into the one virtual device
+  struct output_frame frame;
+  // ticks fall on a grid of tick_period from tick_origin
+  int64_t tick_period, tick_origin, next_deadline;
+  bool ticking;
+#ifdef HAVE_LIBURING
+  // whether the ring is used rather than epoll, reading the gamepads without
+  // libevdev
+  bool uring;
+  struct io_uring ring;
+  // slots whose read has completed and has to be submitted again
+  uint32_t rearm;
+  bool rearm_timer, rearm_wake;
+  uint64_t timer_buf, wake_buf;
+  struct input_event reads[MAX_GAMEPADS][64];
+  // output frames stay here until their writes have completed
+  struct input_event writes[256];
+  size_t writes_used;
+  unsigned int writes_pending;
+  // the last write submitted, linked to the next one to keep them in order
+  struct io_uring_sqe *last_write;
+#endif
+};
+
+void engine_init(struct engine *engine, struct gamepad pads[],
+                 const struct config *config, int uinput_fd, FILE *trace,
+                 bool threaded);
+void engine_destroy(struct engine *engine);
+// what to poll for the engine having work to do
+[[nodiscard]] int engine_fd(const struct engine *engine);
+// handle one wakeup, waiting at most timeout milliseconds for it; returns
+// false once the engine has stopped
+[[nodiscard]] bool engine_poll(struct engine *engine, int timeout);
+// thread entry, polls until stopped
+void *engine_run(void *engine);
+
+// control side
+void engine_send(struct engine *engine, const struct message *message);
+[[nodiscard]] bool engine_receive(struct engine *engine,
+                                  struct message *message);
@@ -1,84 +1,537 @@
+// for the cpu affinity of the engine thread
+#define _GNU_SOURCE
+
+#include <dirent.h>
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <math.h>
-#include <poll.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
-#include <linux/limits.h>
+#include <sys/epoll.h>
 #include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 #include <libevdev/libevdev-uinput.h>
 #include <libevdev/libevdev.h>
 
+#include "cache.h"
+#include "config.h"
+#include "core.h"
+#include "engine.h"
+#include "stats.h"
+#include "telemetry.h"
+#include "trace.h"
+
 const char *evdev_dir = "/dev/input";
 
-[[nodiscard]] static int64_t get_time(void) {
-  struct timespec ts;
-  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
-  return ts.tv_sec * 1'000'000'000ll + ts.tv_nsec;
+// evdev nodes numbered from here on are never remembered as not gamepads
+#define MAX_NODES 1024
+
+// epoll tags of the control loop
+enum { WATCH_SIGNAL, WATCH_INOTIFY, WATCH_ENGINE, WATCH_REPLIES, WATCH_SOCKET };
+
+static void watch(int epoll_fd, int fd, uint64_t tag) {
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd,
+                &(struct epoll_event){.events = EPOLLIN, .data.u64 = tag}) < 0)
+    err(EXIT_FAILURE, "failed to watch fd");
 }
 
-[[nodiscard]] static struct libevdev *find_gamepad(void) {
-  for (int i = 0; i < 32; ++i) {
-    char path[32];
-    sprintf(path, "%s/event%d", evdev_dir, i);
+[[nodiscard]] static bool is_gamepad(const struct libevdev *dev) {
+  return libevdev_has_event_type(dev, EV_ABS) &&
+         libevdev_has_event_code(dev, EV_ABS, ABS_X) &&
+         libevdev_has_event_code(dev, EV_ABS, ABS_Y) &&
+         libevdev_has_event_code(dev, EV_ABS, ABS_RX) &&
+         libevdev_has_event_code(dev, EV_ABS, ABS_RY) &&
+         libevdev_has_event_code(dev, EV_KEY, BTN_A);
+}
 
-    const int fd = open(path, O_RDONLY | O_NONBLOCK);
-    if (fd < 0)
-      break;
+// the gyro and accelerometer of a gamepad, which drivers expose as a node of
+// its own
+[[nodiscard]] static bool is_motion_sensor(const struct libevdev *dev) {
+  return libevdev_has_property(dev, INPUT_PROP_ACCELEROMETER) &&
+         libevdev_has_event_code(dev, EV_ABS, ABS_RX) &&
+         libevdev_has_event_code(dev, EV_ABS, ABS_RY);
+}
+
+// motion sensors are only taken over while the gyro moves the pointer
+[[nodiscard]] static bool gyro_enabled(const struct config *config) {
+  return config->gyro_yaw || config->gyro_pitch;
+}
 
-    struct libevdev *dev;
-    if (libevdev_new_from_fd(fd, &dev) < 0)
-      goto close_fd;
+struct devices {
+  struct gamepad pads[MAX_GAMEPADS];
+  // evdev nodes probed and found not to be gamepads
+  uint64_t ignored[MAX_NODES / 64];
+  struct engine *engine;
+  struct cache cache;
+  // where the cache is kept across restarts, if anywhere
+  const char *cache_path;
+};
+
+static void save_cache(const struct devices *devs) {
+  if (devs->cache_path && !cache_save(&devs->cache, devs->cache_path))
+    warn("failed to save %s", devs->cache_path);
+}
 
-    if (libevdev_has_event_type(dev, EV_ABS) &&
-        libevdev_has_event_code(dev, EV_ABS, ABS_X) &&
-        libevdev_has_event_code(dev, EV_ABS, ABS_Y) &&
-        libevdev_has_event_code(dev, EV_ABS, ABS_RX) &&
-        libevdev_has_event_code(dev, EV_ABS, ABS_RY) &&
-        libevdev_has_event_code(dev, EV_KEY, BTN_A))
-      return dev;
+// have the kernel drop the events the mapping does not look at, so they do not
+// wake the engine; SYN events are always delivered
+static void install_mask(const struct gamepad *pad,
+                         const struct config *config) {
+  const struct mapping *mapping = &config->mapping;
+  uint8_t keys[KEY_CNT / 8] = {}, abs[ABS_CNT / 8] = {}, none[KEY_CNT / 8] = {};
+  if (pad->core.gyro_resolution) {
+    // a motion sensor is only looked at for the gyro axes in use
+    if (config->gyro_yaw)
+      abs[ABS_RY / 8] |= 1 << ABS_RY % 8;
+    if (config->gyro_pitch)
+      abs[ABS_RX / 8] |= 1 << ABS_RX % 8;
+  } else {
+    for (unsigned int code = 0; code < KEY_CNT; ++code) {
+      bool used = code == BTN_MODE || mapping->combos[code];
+      for (unsigned int layer = 0; layer < MAX_LAYERS; ++layer)
+        used |= mapping->keys[layer][code] != 0;
+      if (used)
+        keys[code / 8] |= 1 << code % 8;
+    }
+    for (unsigned int code = 0; code < ABS_CNT; ++code)
+      if (mapping->axes[code].role != AXIS_UNMAPPED)
+        abs[code / 8] |= 1 << code % 8;
+  }
 
+  const struct input_mask masks[] = {
+      {EV_KEY, sizeof(keys), (uintptr_t)keys},
+      {EV_ABS, sizeof(abs), (uintptr_t)abs},
+      {EV_REL, REL_CNT / 8, (uintptr_t)none},
+      {EV_MSC, MSC_CNT / 8, (uintptr_t)none},
+      {EV_SW, SW_CNT / 8, (uintptr_t)none},
+  };
+  for (size_t i = 0; i < sizeof(masks) / sizeof(*masks); ++i)
+    if (ioctl(pad->fd, EVIOCSMASK, &masks[i]) < 0) {
+      warn("failed to filter gamepad events");
+      return;
+    }
+}
+
+// returns N of "eventN", or -1 for other names
+[[nodiscard]] static int parse_node(const char *name) {
+  char *end;
+  if (strncmp(name, "event", 5) != 0 || name[5] < '0' || name[5] > '9')
+    return -1;
+  const long node = strtol(name + 5, &end, 10);
+  return *end == '\0' && node <= INT_MAX ? (int)node : -1;
+}
+
+static void set_ignored(struct devices *devs, int node, bool ignored) {
+  if (node >= MAX_NODES)
+    return;
+  if (ignored)
+    devs->ignored[node / 64] |= 1ull << node % 64;
+  else
+    devs->ignored[node / 64] &= ~(1ull << node % 64);
+}
+
+#define LONG_BITS (sizeof(unsigned long) * 8)
+
+// read a bitmap of a node from sysfs, which prints it as words of unsigned
+// long, most significant first; returns false if it is unavailable
+[[nodiscard]] static bool read_bitmap(int node, const char *name,
+                                      unsigned long *bits, size_t count) {
+  char path[80], line[512];
+  snprintf(path, sizeof(path), "/sys/class/input/event%d/device/%s", node,
+           name);
+  FILE *file = fopen(path, "re");
+  if (file == nullptr)
+    return false;
+  const bool read = fgets(line, sizeof(line), file) != nullptr;
+  fclose(file);
+  if (!read)
+    return false;
+
+  unsigned long words[count];
+  size_t n = 0;
+  char *saveptr;
+  for (char *word = strtok_r(line, " \n", &saveptr); word;
+       word = strtok_r(nullptr, " \n", &saveptr)) {
+    if (n == count)
+      return false;
+    words[n++] = strtoul(word, nullptr, 16);
+  }
+  memset(bits, 0, count * sizeof(*bits));
+  for (size_t i = 0; i < n; ++i)
+    bits[i] = words[n - 1 - i];
+  return true;
+}
+
+[[nodiscard]] static bool has_bit(const unsigned long *bits, unsigned int bit) {
+  return bits[bit / LONG_BITS] >> bit % LONG_BITS & 1;
+}
+
+// whether sysfs shows the node to be neither a gamepad nor a motion sensor as
+// is_gamepad() and is_motion_sensor() would, without opening it; false if
+// sysfs cannot tell
+[[nodiscard]] static bool ruled_out(int node) {
+  unsigned long keys[KEY_CNT / LONG_BITS], abs[ABS_CNT / LONG_BITS],
+      props[(INPUT_PROP_CNT + LONG_BITS - 1) / LONG_BITS];
+  if (!read_bitmap(node, "capabilities/key", keys, KEY_CNT / LONG_BITS) ||
+      !read_bitmap(node, "capabilities/abs", abs, ABS_CNT / LONG_BITS) ||
+      !read_bitmap(node, "properties", props,
+                   sizeof(props) / sizeof(*props)))
+    return false;
+  if (!has_bit(abs, ABS_RX) || !has_bit(abs, ABS_RY))
+    return true;
+  return !has_bit(props, INPUT_PROP_ACCELEROMETER) &&
+         (!has_bit(abs, ABS_X) || !has_bit(abs, ABS_Y) ||
+          !has_bit(keys, BTN_A));
+}
+
+// what opening a node has found
+struct probe {
+  int node, fd;
+  // nullptr if the node is not a gamepad or could not be opened
+  struct libevdev *dev;
+  bool not_gamepad, ruled_out;
+  // how long the node took to open, ns
+  int64_t time;
+};
+
+// whether the node is worth opening: not known to be something else and not
+// open yet
+[[nodiscard]] static bool wanted(const struct devices *devs, int node) {
+  if (node < MAX_NODES && devs->ignored[node / 64] >> node % 64 & 1)
+    return false;
+  for (size_t i = 0; i < MAX_GAMEPADS; ++i)
+    if (devs->pads[i].dev && devs->pads[i].node == node)
+      return false;
+  return true;
+}
+
+// the part of probing that may block and touches no shared state
+static void open_node(struct probe *probe) {
+  const int64_t start = get_time();
+  if ((probe->not_gamepad = probe->ruled_out = ruled_out(probe->node)))
+    return;
+  char path[32];
+  snprintf(path, sizeof(path), "%s/event%d", evdev_dir, probe->node);
+  probe->fd = open(path, O_RDONLY | O_NONBLOCK);
+  if (probe->fd >= 0 && libevdev_new_from_fd(probe->fd, &probe->dev) < 0)
+    probe->dev = nullptr;
+  if (probe->dev && !is_gamepad(probe->dev) &&
+      !is_motion_sensor(probe->dev)) {
+    probe->not_gamepad = true;
+    libevdev_free(probe->dev);
+    probe->dev = nullptr;
+  }
+  if (probe->dev == nullptr && probe->fd >= 0)
+    close(probe->fd);
+  probe->time = get_time() - start;
+}
+
+// MAX_GAMEPADS if there is none
+[[nodiscard]] static size_t free_slot(const struct devices *devs) {
+  size_t slot = 0;
+  while (slot < MAX_GAMEPADS && devs->pads[slot].dev)
+    ++slot;
+  return slot;
+}
+
+// take over the gamepad a probe has opened; nodes that could not be opened
+// are probed again once udev changes their permissions
+static void adopt(struct devices *devs, const struct probe *probe,
+                  const struct config *config) {
+  if (probe->not_gamepad)
+    set_ignored(devs, probe->node, true);
+  struct libevdev *dev = probe->dev;
+  if (dev == nullptr)
+    return;
+  if (!gyro_enabled(config) && is_motion_sensor(dev)) {
+    // not ignored, so a reload turning the gyro on finds it again
     libevdev_free(dev);
-  close_fd:
-    close(fd);
+    close(probe->fd);
+    return;
+  }
+  const size_t slot = free_slot(devs);
+  if (slot == MAX_GAMEPADS) {
+    warnx("too many gamepads, ignoring event%d", probe->node);
+    libevdev_free(dev);
+    close(probe->fd);
+    return;
   }
 
+  struct device_id id = {.bustype = (uint16_t)libevdev_get_id_bustype(dev),
+                         .vendor = (uint16_t)libevdev_get_id_vendor(dev),
+                         .product = (uint16_t)libevdev_get_id_product(dev),
+                         .version = (uint16_t)libevdev_get_id_version(dev)};
+  const char *uniq = libevdev_get_uniq(dev);
+  if (uniq)
+    snprintf(id.uniq, sizeof(id.uniq), "%s", uniq);
+  struct gamepad *pad = &devs->pads[slot];
+  *pad = (struct gamepad){.dev = dev,
+                          .fd = probe->fd,
+                          .node = probe->node,
+                          .enabled = true,
+                          .id = id};
+  pad->clock_set = libevdev_set_clock_id(dev, clock_id) == 0;
+  if (!pad->clock_set)
+    warnx("failed to set gamepad clock, timing by wakeups");
+  const bool event_timing = config->event_timing && pad->clock_set;
+
+  if (is_motion_sensor(dev)) {
+    // motion sensors share the id of their gamepad, so they are not cached,
+    // and they are left to games reading them as well; the gyro of most
+    // drivers has the same resolution on all axes
+    warnx("motion sensor found: %s", libevdev_get_name(dev));
+    const int resolution = libevdev_get_abs_resolution(dev, ABS_RX);
+    core_init_motion(&pad->core, config, resolution > 0 ? resolution : 1,
+                     event_timing, get_time());
+  } else {
+    struct cache_entry *entry = cache_find(&devs->cache, &id);
+    if (entry == nullptr) {
+      entry = cache_add(&devs->cache, &id);
+      calibration_init(&entry->calibration);
+      for (int code = 0; code < ABS_CNT; ++code) {
+        const struct input_absinfo *info = libevdev_get_abs_info(dev, code);
+        if (info)
+          calibrate_axis(&entry->calibration.axes[code], info->minimum,
+                         info->maximum);
+      }
+      save_cache(devs);
+    }
+
+    warnx("gamepad found: %s", libevdev_get_name(dev));
+    const int rc = libevdev_grab(dev, LIBEVDEV_GRAB);
+    if (rc < 0) {
+      errno = -rc;
+      warn("failed to grab the gamepad");
+    }
+    core_init(&pad->core, config, &entry->calibration, event_timing,
+              get_time());
+  }
+  install_mask(pad, config);
+  telemetry_attach((unsigned int)slot, pad);
+  const struct message add = {.type = ENGINE_ADD, .slot = (unsigned int)slot};
+  engine_send(devs->engine, &add);
+}
+
+static void probe_node(struct devices *devs, int node,
+                       const struct config *config) {
+  if (!wanted(devs, node))
+    return;
+  struct probe probe = {.node = node};
+  open_node(&probe);
+  adopt(devs, &probe, config);
+}
+
+// nodes opened by scan_nodes() at once, which may each block for a while on
+// slow hubs
+#define SCAN_THREADS 8
+
+struct scan {
+  struct probe *probes;
+  size_t count;
+  atomic_size_t next;
+  // how many sysfs has ruled out, and how long opening all of them took, ns
+  size_t ruled_out;
+  int64_t time;
+};
+
+static void *scan_thread(void *data) {
+  struct scan *scan = data;
+  for (size_t i; (i = atomic_fetch_add(&scan->next, 1)) < scan->count;)
+    open_node(&scan->probes[i]);
   return nullptr;
 }
 
-[[nodiscard]] static struct libevdev_uinput *create_virtual_device() {
+// open every evdev node worth it in parallel, for adopt_nodes()
+static void open_nodes(const struct devices *devs, struct scan *scan) {
+  const int64_t start = get_time();
+  *scan = (struct scan){};
+  DIR *dir = opendir(evdev_dir);
+  if (dir == nullptr)
+    err(EXIT_FAILURE, "failed to open %s", evdev_dir);
+  size_t capacity = 0;
+  for (const struct dirent *entry; (entry = readdir(dir));) {
+    const int node = parse_node(entry->d_name);
+    if (node < 0 || !wanted(devs, node))
+      continue;
+    if (scan->count == capacity &&
+        (scan->probes = reallocarray(scan->probes, capacity = capacity * 2 + 16,
+                                     sizeof(*scan->probes))) == nullptr)
+      err(EXIT_FAILURE, "failed to allocate probes");
+    scan->probes[scan->count++] = (struct probe){.node = node};
+  }
+  closedir(dir);
+
+  pthread_t threads[SCAN_THREADS];
+  size_t started = 0;
+  while (started < SCAN_THREADS && started + 1 < scan->count &&
+         pthread_create(&threads[started], nullptr, scan_thread, scan) == 0)
+    ++started;
+  scan_thread(scan);
+  for (size_t i = 0; i < started; ++i)
+    pthread_join(threads[i], nullptr);
+  for (size_t i = 0; i < scan->count; ++i)
+    scan->ruled_out += scan->probes[i].ruled_out;
+  scan->time = get_time() - start;
+}
+
+[[nodiscard]] static int compare_probes(const void *a, const void *b) {
+  const int x = ((const struct probe *)a)->node,
+            y = ((const struct probe *)b)->node;
+  return (x > y) - (x < y);
+}
+
+// take over the gamepads open_nodes() has found, in the order of their nodes
+static void adopt_nodes(struct devices *devs, struct scan *scan,
+                        const struct config *config) {
+  qsort(scan->probes, scan->count, sizeof(*scan->probes), compare_probes);
+  for (size_t i = 0; i < scan->count; ++i)
+    adopt(devs, &scan->probes[i], config);
+  free(scan->probes);
+}
+
+// probe every evdev node, only needed at startup and if inotify overflows
+static void scan_nodes(struct devices *devs, const struct config *config) {
+  struct scan scan;
+  open_nodes(devs, &scan);
+  adopt_nodes(devs, &scan, config);
+}
+
+// close a gamepad the engine has handed back; the caller saves the cache with
+// the calibration measured meanwhile
+static void close_gamepad(struct devices *devs, struct gamepad *pad) {
+  telemetry_detach((unsigned int)(pad - devs->pads));
+  if (pad->remote)
+    warnx("remote gamepad gone: %s", libevdev_get_name(pad->dev));
+  // remote gamepads and motion sensors are neither cached nor grabbed
+  if (!pad->remote && !pad->core.gyro_resolution) {
+    // the entry may have gone to another device if the cache is full
+    struct cache_entry *entry = cache_find(&devs->cache, &pad->id);
+    if (entry)
+      entry->calibration = pad->core.calibration;
+    libevdev_grab(pad->dev, LIBEVDEV_UNGRAB);
+  }
+  libevdev_free(pad->dev);
+  close(pad->fd);
+  pad->dev = nullptr;
+}
+
+// listen for remote gamepads on a SOCK_SEQPACKET socket, replacing one left
+// behind by a previous run
+[[nodiscard]] static int listen_socket(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  struct stat st;
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+  const int fd =
+      socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  if (bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(fd, MAX_GAMEPADS) < 0) {
+    const int error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+  return fd;
+}
+
+// take over every connection to the socket as a gamepad of its own; remote
+// axes are calibrated as ranging over -32768..32767, triggers included
+// remote sticks are taken to range over -32768..32767, and the axes the mapping
+// reads as triggers when they connect over 0..32767, so that a trigger at rest
+// reads as released
+static void calibrate_remote(struct calibration *calibration,
+                             const struct mapping *mapping) {
+  calibration_init(calibration);
+  for (int code = 0; code < ABS_CNT; ++code)
+    if (mapping->axes[code].role >= AXIS_TRIGGER)
+      calibrate_axis(&calibration->axes[code], 0, 32767);
+}
+
+static void accept_remotes(struct devices *devs, int socket_fd,
+                           const struct config *config) {
+  for (int fd; (fd = accept4(socket_fd, nullptr, nullptr,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0;) {
+    const size_t slot = free_slot(devs);
+    if (slot == MAX_GAMEPADS) {
+      warnx("too many gamepads, refusing remote gamepad");
+      close(fd);
+      continue;
+    }
+    struct ucred cred = {};
+    socklen_t size = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &size) < 0)
+      cred.pid = 0;
+    char name[32];
+    snprintf(name, sizeof(name), "remote gamepad (pid %d)", (int)cred.pid);
+    struct libevdev *dev = libevdev_new();
+    if (dev == nullptr)
+      err(EXIT_FAILURE, "failed to allocate remote gamepad");
+    libevdev_set_name(dev, name);
+
+    struct gamepad *pad = &devs->pads[slot];
+    warnx("gamepad found: %s", name);
+    // the engine stamps remote events with clock_id as they arrive
+    *pad = (struct gamepad){.dev = dev,
+                            .fd = fd,
+                            .node = -1,
+                            .enabled = true,
+                            .remote = true,
+                            .clock_set = true,
+                            .id = {.bustype = BUS_VIRTUAL}};
+    struct calibration calibration;
+    calibrate_remote(&calibration, &config->mapping);
+    core_init(&pad->core, config, &calibration, config->event_timing,
+              get_time());
+    telemetry_attach((unsigned int)slot, pad);
+    const struct message add = {.type = ENGINE_ADD,
+                                .slot = (unsigned int)slot};
+    engine_send(devs->engine, &add);
+  }
+  if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+    warn("failed to accept remote gamepad");
+}
+
+[[nodiscard]] static struct libevdev_uinput *
+create_virtual_device(const struct mapping *mapping) {
   struct libevdev *dev = libevdev_new();
   libevdev_set_name(dev, "Joy2KeyMouse Virtual Input");
 
   libevdev_enable_event_type(dev, EV_REL);
   libevdev_enable_event_code(dev, EV_REL, REL_X, nullptr);
   libevdev_enable_event_code(dev, EV_REL, REL_Y, nullptr);
+  libevdev_enable_event_code(dev, EV_REL, REL_WHEEL, nullptr);
+  libevdev_enable_event_code(dev, EV_REL, REL_HWHEEL, nullptr);
   libevdev_enable_event_code(dev, EV_REL, REL_WHEEL_HI_RES, nullptr);
   libevdev_enable_event_code(dev, EV_REL, REL_HWHEEL_HI_RES, nullptr);
 
   libevdev_enable_event_type(dev, EV_KEY);
-  libevdev_enable_event_code(dev, EV_KEY, BTN_LEFT, nullptr);
-  libevdev_enable_event_code(dev, EV_KEY, BTN_RIGHT, nullptr);
-  libevdev_enable_event_code(dev, EV_KEY, BTN_SIDE, nullptr);
-  libevdev_enable_event_code(dev, EV_KEY, BTN_EXTRA, nullptr);
-  libevdev_enable_event_code(dev, EV_KEY, KEY_TAB, nullptr);
-  libevdev_enable_event_code(dev, EV_KEY, KEY_A, nullptr);
-  libevdev_enable_event_code(dev, EV_KEY, KEY_LEFTMETA, nullptr);
-  libevdev_enable_event_code(dev, EV_KEY, KEY_LEFTSHIFT, nullptr);
-  libevdev_enable_event_code(dev, EV_KEY, KEY_LEFTCTRL, nullptr);
-  libevdev_enable_event_code(dev, EV_KEY, KEY_LEFTALT, nullptr);
-  libevdev_enable_event_code(dev, EV_KEY, KEY_ENTER, nullptr);
-  libevdev_enable_event_code(dev, EV_KEY, KEY_LEFT, nullptr);
-  libevdev_enable_event_code(dev, EV_KEY, KEY_RIGHT, nullptr);
-  libevdev_enable_event_code(dev, EV_KEY, KEY_UP, nullptr);
-  libevdev_enable_event_code(dev, EV_KEY, KEY_DOWN, nullptr);
+  for (unsigned int i = 1; i < mapping->chord_count; ++i)
+    for (unsigned int j = 0; j < mapping->chords[i].count; ++j)
+      libevdev_enable_event_code(dev, EV_KEY, mapping->chords[i].codes[j],
+                                 nullptr);
 
   struct libevdev_uinput *uinput;
   const int rc = libevdev_uinput_create_from_device(
@@ -92,292 +545,414 @@ const char *evdev_dir = "/dev/input";
   return uinput;
 }
 
-int main(void) {
+// creating the virtual device waits on udev, so it is done while the gamepads
+// are probed
+struct creation {
+  const struct mapping *mapping;
+  struct libevdev_uinput *uinput;
+  int error;
+  int64_t time;
+};
+
+static void *create_thread(void *data) {
+  struct creation *creation = data;
+  const int64_t start = get_time();
+  creation->uinput = create_virtual_device(creation->mapping);
+  creation->error = errno;
+  creation->time = get_time() - start;
+  return nullptr;
+}
+
+// returns whether the daemon should exit
+[[nodiscard]] static bool handle_signals(int fd) {
+  bool quit = false;
+  struct signalfd_siginfo info;
+  while (read(fd, &info, sizeof(info)) == sizeof(info))
+    if (info.ssi_signo == SIGUSR1)
+      stats_dump();
+    else
+      quit = true;
+  if (quit)
+    warnx("exiting");
+  return quit;
+}
+
+// drain inotify, probing the evdev nodes that have appeared or changed;
+// returns whether the config file has changed
+[[nodiscard]] static bool read_inotify(int fd, int config_wd,
+                                       const char *config_name,
+                                       struct devices *devs,
+                                       const struct config *config) {
+  bool changed = false;
+  while (true) {
+    char buf[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    const ssize_t len = read(fd, buf, sizeof(buf));
+    if (len < 0) {
+      if (errno == EAGAIN)
+        return changed;
+      err(EXIT_FAILURE, "failed to read inotify");
+    }
+    for (const char *p = buf; p < buf + len;) {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + ev->len;
+      if (ev->mask & IN_Q_OVERFLOW) {
+        warnx("inotify queue overflowed, rescanning %s", evdev_dir);
+        scan_nodes(devs, config);
+        changed |= config_wd >= 0;
+        continue;
+      }
+      if (ev->len == 0)
+        continue;
+      if (ev->wd == config_wd) {
+        changed |= strcmp(ev->name, config_name) == 0;
+        continue;
+      }
+      const int node = parse_node(ev->name);
+      if (node < 0)
+        continue;
+      if (ev->mask & IN_DELETE)
+        set_ignored(devs, node, false);
+      else
+        probe_node(devs, node, config);
+    }
+  }
+}
+
+// options that override settings of the config file
+static const char *const settings[] = {['r'] = "tick_rate",
+                                       ['L'] = "left_curve",
+                                       ['R'] = "right_curve",
+                                       ['T'] = "timing"};
+
+[[nodiscard]] static struct config *
+load_config(const char *path, char *const overrides[]) {
+  struct config *config = malloc(sizeof(*config));
+  if (config == nullptr)
+    err(EXIT_FAILURE, "failed to allocate config");
+  config_init(config);
+  bool ok = path == nullptr || config_load(config, path);
+  for (size_t i = 0; i < sizeof(settings) / sizeof(*settings); ++i)
+    if (overrides[i] && !config_set(config, settings[i], overrides[i])) {
+      warnx("invalid %s: %s", settings[i], overrides[i]);
+      ok = false;
+    }
+  if (!ok) {
+    free(config);
+    return nullptr;
+  }
+  config_build(config);
+  return config;
+}
+
+// the virtual device cannot gain keys, so changing those needs a restart
+static void check_virtual_keys(const struct mapping *mapping,
+                               const struct mapping *created) {
+  bool enabled[KEY_CNT] = {};
+  for (unsigned int i = 1; i < created->chord_count; ++i)
+    for (unsigned int j = 0; j < created->chords[i].count; ++j)
+      enabled[created->chords[i].codes[j]] = true;
+  for (unsigned int i = 1; i < mapping->chord_count; ++i)
+    for (unsigned int j = 0; j < mapping->chords[i].count; ++j)
+      if (!enabled[mapping->chords[i].codes[j]]) {
+        enabled[mapping->chords[i].codes[j]] = true;
+        warnx("%s is not enabled on the virtual device until restart",
+              libevdev_event_code_get_name(EV_KEY,
+                                           mapping->chords[i].codes[j]));
+      }
+}
+
+[[nodiscard]] static bool parse_int(const char *s, int minimum, int maximum,
+                                    int *value) {
+  char *end;
+  const long n = strtol(s, &end, 10);
+  if (*s == '\0' || *end != '\0' || n < minimum || n > maximum)
+    return false;
+  *value = (int)n;
+  return true;
+}
+
+// run the engine on a thread of its own, pinned to cpu unless it is negative
+// and at the SCHED_FIFO priority unless it is 0
+static void start_engine(pthread_t *thread, struct engine *engine, int priority,
+                         int cpu) {
+  // page faults must not stall the real-time thread
+  if (priority && mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+    warn("failed to lock memory");
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  if (priority) {
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    const struct sched_param param = {.sched_priority = priority};
+    pthread_attr_setschedparam(&attr, &param);
+  }
+  int rc = pthread_create(thread, &attr, engine_run, engine);
+  if (rc == EPERM && priority) {
+    warnx("not permitted to use real-time priority, running at normal one");
+    pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+    rc = pthread_create(thread, &attr, engine_run, engine);
+  }
+  pthread_attr_destroy(&attr);
+  if (rc) {
+    errno = rc;
+    err(EXIT_FAILURE, "failed to start engine thread");
+  }
+}
+
+int main(int argc, char *argv[]) {
+  const char *config_path = nullptr, *trace_path = nullptr,
+             *cache_path = nullptr, *telemetry_path = nullptr,
+             *socket_path = nullptr;
+  char *overrides[sizeof(settings) / sizeof(*settings)] = {};
+  bool threaded = false, dump_stats = false;
+  int priority = 0, cpu = -1;
+  for (int opt; (opt = getopt(argc, argv, "c:r:L:R:T:so:C:p:a:m:i:")) != -1;)
+    switch (opt) {
+    case 'c':
+      config_path = optarg;
+      break;
+    case 'r':
+    case 'L':
+    case 'R':
+    case 'T':
+      overrides[opt] = optarg;
+      break;
+    case 's':
+      stats->enabled = dump_stats = true;
+      break;
+    case 'o':
+      trace_path = optarg;
+      break;
+    case 'C':
+      cache_path = optarg;
+      break;
+    case 'p':
+      if (!parse_int(optarg, 1, sched_get_priority_max(SCHED_FIFO),
+                     &priority))
+        errx(EXIT_FAILURE, "invalid priority: %s", optarg);
+      threaded = true;
+      break;
+    case 'a':
+      if (!parse_int(optarg, 0, CPU_SETSIZE - 1, &cpu))
+        errx(EXIT_FAILURE, "invalid cpu: %s", optarg);
+      threaded = true;
+      break;
+    case 'm':
+      telemetry_path = optarg;
+      break;
+    case 'i':
+      socket_path = optarg;
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-c config_file] [-r tick_rate] [-L curve] "
+              "[-R curve] [-T timing] [-s] [-o trace_file] [-C cache_file] "
+              "[-p priority] [-a cpu] [-m telemetry_file] "
+              "[-i socket_file]\n",
+              argv[0]);
+      return EXIT_FAILURE;
+    }
+  const int64_t start = get_time();
+  struct config *config = load_config(config_path, overrides);
+  if (config == nullptr)
+    errx(EXIT_FAILURE, "invalid configuration");
+  if (telemetry_path && !telemetry_open(telemetry_path))
+    err(EXIT_FAILURE, "failed to create %s", telemetry_path);
+  // the mapping the virtual device has been created for
+  const struct mapping created_mapping = config->mapping;
+  const int64_t configured = get_time();
+
+  FILE *trace = nullptr;
+  if (trace_path && (trace = trace_create(trace_path)) == nullptr)
+    err(EXIT_FAILURE, "failed to create trace file");
+
   sigset_t sigmask;
   sigemptyset(&sigmask);
   sigaddset(&sigmask, SIGINT);
   sigaddset(&sigmask, SIGTERM);
+  sigaddset(&sigmask, SIGUSR1);
   sigprocmask(SIG_BLOCK, &sigmask, nullptr);
   const int signal_fd = signalfd(-1, &sigmask, SFD_NONBLOCK);
   if (signal_fd < 0)
     err(EXIT_FAILURE, "failed to create signalfd");
 
-  struct libevdev_uinput *uinput = create_virtual_device();
-  if (uinput == nullptr)
-    err(EXIT_FAILURE, "failed to create virtual device");
-  warnx("created virtual device: %s", libevdev_uinput_get_devnode(uinput));
+  struct creation creation = {.mapping = &created_mapping};
+  pthread_t create;
+  if (pthread_create(&create, nullptr, create_thread, &creation) != 0)
+    err(EXIT_FAILURE, "failed to start creating the virtual device");
 
   const int ino_fd = inotify_init1(IN_NONBLOCK);
   if (ino_fd < 0)
     err(EXIT_FAILURE, "failed to init inotify");
-  if (inotify_add_watch(ino_fd, evdev_dir, IN_CREATE) < 0)
+  // udev makes new nodes accessible only after creating them
+  const uint32_t evdev_events = IN_CREATE | IN_ATTRIB | IN_DELETE;
+  if (inotify_add_watch(ino_fd, evdev_dir, evdev_events) < 0)
     err(EXIT_FAILURE, "failed to monitor evdev");
+  // watch the directory, editors tend to replace files rather than write them
+  int config_wd = -1;
+  char *config_name = nullptr;
+  if (config_path) {
+    char *dir = strdup(config_path), *base = strdup(config_path);
+    if (dir == nullptr || base == nullptr)
+      err(EXIT_FAILURE, "failed to allocate config path");
+    config_name = strdup(basename(base));
+    config_wd = inotify_add_watch(ino_fd, dirname(dir),
+                                  IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (config_wd < 0)
+      warn("failed to monitor %s, it will not be reloaded", config_path);
+    free(dir);
+    free(base);
+  }
 
-  for (bool quit = false;;) {
-    struct pollfd poll_fds[] = {
-        (struct pollfd){.fd = -1, .events = POLLIN},
-        (struct pollfd){.fd = signal_fd, .events = POLLIN}};
-
-    struct libevdev *gamepad = find_gamepad();
-    if (gamepad == nullptr)
-      goto wait_hotplug;
-    const int gamepad_fd = poll_fds[0].fd = libevdev_get_fd(gamepad);
-    warnx("gamepad found: %s", libevdev_get_name(gamepad));
-    const int rc = libevdev_grab(gamepad, LIBEVDEV_GRAB);
-    if (rc < 0) {
-      errno = -rc;
-      warn("failed to grab the gamepad");
+  struct devices devs = {.cache_path = cache_path};
+  if (cache_path && !cache_load(&devs.cache, cache_path))
+    warn("failed to load %s, starting with an empty cache", cache_path);
+  // nodes created from here on are reported by inotify as well and opened
+  // once adopt_nodes() has run
+  struct scan scan;
+  open_nodes(&devs, &scan);
+
+  pthread_join(create, nullptr);
+  struct libevdev_uinput *uinput = creation.uinput;
+  if (uinput == nullptr) {
+    errno = creation.error;
+    err(EXIT_FAILURE, "failed to create virtual device");
+  }
+  warnx("created virtual device: %s", libevdev_uinput_get_devnode(uinput));
+
+  struct engine engine;
+  engine_init(&engine, devs.pads, config, libevdev_uinput_get_fd(uinput),
+              trace, threaded);
+  devs.engine = &engine;
+
+  const int epoll_fd = epoll_create1(0);
+  if (epoll_fd < 0)
+    err(EXIT_FAILURE, "failed to create epoll");
+  watch(epoll_fd, signal_fd, WATCH_SIGNAL);
+  watch(epoll_fd, ino_fd, WATCH_INOTIFY);
+  watch(epoll_fd, engine.notify_fd, WATCH_REPLIES);
+  int socket_fd = -1;
+  if (socket_path) {
+    if ((socket_fd = listen_socket(socket_path)) < 0)
+      err(EXIT_FAILURE, "failed to listen on %s", socket_path);
+    watch(epoll_fd, socket_fd, WATCH_SOCKET);
+  }
+  pthread_t engine_thread;
+  if (threaded)
+    start_engine(&engine_thread, &engine, priority, cpu);
+  else
+    // the engine runs whenever any of its fds is ready
+    watch(epoll_fd, engine_fd(&engine), WATCH_ENGINE);
+
+  const int64_t adopting = get_time();
+  adopt_nodes(&devs, &scan, config);
+  const int64_t started = get_time();
+  warnx("started in %.1f ms: config %.1f ms, virtual device %.1f ms, "
+        "probing %zu nodes (%zu ruled out by sysfs) %.1f ms, adoption %.1f ms",
+        (double)(started - start) / 1e6, (double)(configured - start) / 1e6,
+        (double)creation.time / 1e6, scan.count, scan.ruled_out,
+        (double)scan.time / 1e6, (double)(started - adopting) / 1e6);
+
+  for (bool quit = false; !quit;) {
+    struct epoll_event ready[5];
+    const int count = epoll_wait(epoll_fd, ready, 5, -1);
+    bool reload = false;
+
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      err(EXIT_FAILURE, "epoll_wait failed");
     }
 
-    bool enabled = true;
-    int lx = 0, ly = 0, rx = 0, ry = 0;
-    int hat0x = 0, hat0y = 0;
-    bool lz = false, rz = false;
-    const double lbase = 1.01;
-    const int64_t ldiv1 = 1ll << 9, lsub = 1ll << 13, ldiv2 = 1ll << 36,
-                  lmul = 1;
-    const double rbase = 1.01;
-    const int64_t rdiv1 = 1ll << 9, rsub = 1ll << 13, rdiv2 = 1ll << 36,
-                  rmul = 2;
-    const int z_down_threshold = 512, z_up_threshold = 256;
-    int64_t last_time = get_time();
-
-    while (true) {
-      const int rc = poll(poll_fds, 2, 20);
-      const int64_t current_time = get_time();
-      const int64_t interval = current_time - last_time;
-      last_time = current_time;
-
-      if (rc < 0)
-        err(EXIT_FAILURE, "poll failed");
-
-      if (poll_fds[1].revents) {
-        warnx("exiting");
-        quit = true;
+    for (int i = 0; i < count; ++i)
+      switch (ready[i].data.u64) {
+      case WATCH_SIGNAL:
+        quit |= handle_signals(signal_fd);
+        break;
+      case WATCH_INOTIFY:
+        reload |= read_inotify(ino_fd, config_wd, config_name, &devs, config);
+        break;
+      case WATCH_ENGINE:
+        (void)engine_poll(&engine, 0);
+        break;
+      case WATCH_REPLIES: {
+        uint64_t replies;
+        if (read(engine.notify_fd, &replies, sizeof(replies)) < 0 &&
+            errno != EAGAIN)
+          err(EXIT_FAILURE, "failed to read eventfd");
         break;
       }
-
-      if (poll_fds[0].revents) {
-        struct input_event ev;
-        const int rc =
-            libevdev_next_event(gamepad, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-        if (rc < 0) {
-          if (rc == -ENODEV) {
-            warnx("gamepad disconnected");
-            break;
-          }
-          errno = -rc;
-          err(EXIT_FAILURE, "failed to read event");
-        }
-        switch (rc) {
-        case LIBEVDEV_READ_STATUS_SUCCESS:
-          break;
-        case LIBEVDEV_READ_STATUS_SYNC:
-          warnx("some events have been dropped by kernel");
-          break;
-        default:
-          warnx("libevdev_next_event returned unknown error");
-          break;
-        }
-
-        if (ev.type == EV_KEY && ev.code == BTN_MODE && ev.value == 0) {
-          const int rc =
-              libevdev_grab(gamepad, ((enabled = !enabled)) ? LIBEVDEV_GRAB
-                                                            : LIBEVDEV_UNGRAB);
-          if (rc < 0) {
-            errno = -rc;
-            warn("failed to grab the gamepad");
-          }
-        }
-        if (!enabled)
-          continue;
-
-        switch (ev.type) {
-        case EV_ABS:
-          switch (ev.code) {
-          case ABS_X:
-            lx = ev.value;
-            break;
-          case ABS_Y:
-            ly = ev.value;
-            break;
-          case ABS_RX:
-            rx = ev.value;
-            break;
-          case ABS_RY:
-            ry = ev.value;
-            break;
-          case ABS_HAT0X:
-            if (hat0x && hat0x != ev.value) {
-              libevdev_uinput_write_event(uinput, EV_KEY,
-                                          hat0x < 0 ? KEY_LEFT : KEY_RIGHT, 0);
-              libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
-            }
-            hat0x = ev.value;
-            if (hat0x) {
-              libevdev_uinput_write_event(uinput, EV_KEY,
-                                          hat0x < 0 ? KEY_LEFT : KEY_RIGHT, 1);
-              libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
-            }
-            break;
-          case ABS_HAT0Y:
-            if (hat0y && hat0y != ev.value) {
-              libevdev_uinput_write_event(uinput, EV_KEY,
-                                          hat0y < 0 ? KEY_UP : KEY_DOWN, 0);
-              libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
-            }
-            hat0y = ev.value;
-            if (hat0y) {
-              libevdev_uinput_write_event(uinput, EV_KEY,
-                                          hat0y < 0 ? KEY_UP : KEY_DOWN, 1);
-              libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
-            }
-            break;
-          case ABS_Z:
-            if (ev.value > z_down_threshold && !lz) {
-              libevdev_uinput_write_event(uinput, EV_KEY, KEY_LEFTCTRL,
-                                          lz = true);
-              libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
-            }
-            if (ev.value < z_up_threshold && lz) {
-              libevdev_uinput_write_event(uinput, EV_KEY, KEY_LEFTCTRL,
-                                          lz = false);
-              libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
-            }
-            break;
-          case ABS_RZ:
-            if (ev.value > z_down_threshold && !rz) {
-              libevdev_uinput_write_event(uinput, EV_KEY, KEY_LEFTSHIFT,
-                                          rz = true);
-              libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
-            }
-            if (ev.value < z_up_threshold && rz) {
-              libevdev_uinput_write_event(uinput, EV_KEY, KEY_LEFTSHIFT,
-                                          rz = false);
-              libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
-            }
-            break;
-          }
-          break;
-
-        case EV_KEY:
-          switch (ev.code) {
-          case BTN_SOUTH:
-            libevdev_uinput_write_event(uinput, EV_KEY, BTN_LEFT, ev.value);
-            break;
-          case BTN_EAST:
-            libevdev_uinput_write_event(uinput, EV_KEY, BTN_RIGHT, ev.value);
-            break;
-          case BTN_SELECT:
-            libevdev_uinput_write_event(uinput, EV_KEY, KEY_LEFTMETA, ev.value);
-            break;
-          case BTN_START:
-            libevdev_uinput_write_event(uinput, EV_KEY, KEY_LEFTMETA, ev.value);
-            libevdev_uinput_write_event(uinput, EV_KEY, KEY_A, ev.value);
-            break;
-          case BTN_TR:
-            libevdev_uinput_write_event(uinput, EV_KEY, KEY_TAB, ev.value);
-            break;
-          case BTN_TL:
-            libevdev_uinput_write_event(uinput, EV_KEY, KEY_LEFTSHIFT,
-                                        ev.value);
-            libevdev_uinput_write_event(uinput, EV_KEY, KEY_TAB, ev.value);
-            break;
-          case BTN_DPAD_UP:
-            libevdev_uinput_write_event(uinput, EV_KEY, KEY_UP, ev.value);
-            break;
-          case BTN_DPAD_DOWN:
-            libevdev_uinput_write_event(uinput, EV_KEY, KEY_DOWN, ev.value);
-            break;
-          case BTN_DPAD_LEFT:
-            libevdev_uinput_write_event(uinput, EV_KEY, KEY_LEFT, ev.value);
-            break;
-          case BTN_DPAD_RIGHT:
-            libevdev_uinput_write_event(uinput, EV_KEY, KEY_RIGHT, ev.value);
-            break;
-          case BTN_WEST:
-            libevdev_uinput_write_event(uinput, EV_KEY, BTN_EXTRA, ev.value);
-            break;
-          case BTN_NORTH:
-            libevdev_uinput_write_event(uinput, EV_KEY, BTN_SIDE, ev.value);
-            break;
-          case BTN_THUMBL:
-            libevdev_uinput_write_event(uinput, EV_KEY, KEY_LEFTALT, ev.value);
-            break;
-          case BTN_THUMBR:
-            libevdev_uinput_write_event(uinput, EV_KEY, KEY_ENTER, ev.value);
-            break;
-          }
-          libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
-          break;
-        }
-      }
-
-      const int slx = (int)((int64_t)(pow(lbase,
-                                          (double)((abs(lx) - lsub) / ldiv1)) *
-                                      lx) *
-                            interval / ldiv2 * lmul),
-                sly = (int)((int64_t)(pow(lbase,
-                                          (double)((abs(ly) - lsub) / ldiv1)) *
-                                      ly) *
-                            interval / ldiv2 * lmul);
-      if (slx || sly) {
-        libevdev_uinput_write_event(uinput, EV_REL, REL_X, slx);
-        libevdev_uinput_write_event(uinput, EV_REL, REL_Y, sly);
-        libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
-      }
-
-      const int srx = (int)((int64_t)(pow(rbase,
-                                          (double)((abs(rx) - rsub) / rdiv1)) *
-                                      rx) *
-                            interval / rdiv2 * rmul),
-                sry = (int)((int64_t)(pow(rbase,
-                                          (double)((abs(ry) - rsub) / rdiv1)) *
-                                      ry) *
-                            interval / rdiv2 * rmul);
-      if (srx || sry) {
-        if (abs(srx) > abs(sry))
-          libevdev_uinput_write_event(uinput, EV_REL, REL_HWHEEL_HI_RES, -srx);
-        else
-          libevdev_uinput_write_event(uinput, EV_REL, REL_WHEEL_HI_RES, sry);
-        libevdev_uinput_write_event(uinput, EV_SYN, SYN_REPORT, 0);
+      case WATCH_SOCKET:
+        accept_remotes(&devs, socket_fd, config);
+        break;
       }
-    }
-
-    libevdev_grab(gamepad, LIBEVDEV_UNGRAB);
-    libevdev_free(gamepad);
-    close(gamepad_fd);
-    if (quit)
-      break;
-  wait_hotplug:
-    poll_fds[0].fd = ino_fd;
-    while (true) {
-      const int rc = poll(poll_fds, 2, -1);
-
-      if (rc < 0)
-        err(EXIT_FAILURE, "poll failed");
 
-      if (poll_fds[1].revents) {
-        warnx("exiting");
-        goto outer;
+    for (struct message message; engine_receive(&engine, &message);)
+      if (message.type == ENGINE_REMOVED) {
+        close_gamepad(&devs, &devs.pads[message.slot]);
+        save_cache(&devs);
+      } else if (message.type == ENGINE_RETIRED) {
+        free((void *)message.config);
       }
 
-      if (poll_fds[0].revents) {
-        while (true) {
-          char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
-          if (read(ino_fd, buf, sizeof(buf)) < 0) {
-            if (errno == EAGAIN)
-              break;
-            err(EXIT_FAILURE, "failed to read inotify");
-          }
-        }
-        break;
+    if (reload) {
+      struct config *new_config = load_config(config_path, overrides);
+      if (new_config) {
+        warnx("reloaded %s", config_path);
+        check_virtual_keys(&new_config->mapping, &created_mapping);
+        for (size_t i = 0; i < MAX_GAMEPADS; ++i)
+          if (devs.pads[i].dev && !devs.pads[i].remote)
+            install_mask(&devs.pads[i], new_config);
+        // the old config is freed once the engine has switched away from it
+        engine_send(&engine, &(struct message){.type = ENGINE_CONFIG,
+                                               .config = new_config});
+        const bool rescan = gyro_enabled(new_config) && !gyro_enabled(config);
+        config = new_config;
+        // for the motion sensors skipped while the gyro was off
+        if (rescan)
+          scan_nodes(&devs, config);
+      } else {
+        warnx("keeping the previous configuration");
       }
     }
   }
 
-outer:
+  engine_send(&engine, &(struct message){.type = ENGINE_STOP});
+  if (threaded)
+    pthread_join(engine_thread, nullptr);
+  else
+    while (engine_poll(&engine, -1))
+      ;
+  for (struct message message; engine_receive(&engine, &message);)
+    if (message.type == ENGINE_RETIRED)
+      free((void *)message.config);
+  // before the gamepads are closed, reads may still be pending on them
+  engine_destroy(&engine);
+  for (size_t i = 0; i < MAX_GAMEPADS; ++i)
+    if (devs.pads[i].dev)
+      close_gamepad(&devs, &devs.pads[i]);
+  save_cache(&devs);
+  if (dump_stats)
+    stats_dump();
+  telemetry_close(telemetry_path);
+  if (socket_path) {
+    close(socket_fd);
+    unlink(socket_path);
+  }
+  if (trace && fclose(trace) != 0)
+    warn("failed to write trace file");
+  close(epoll_fd);
   close(ino_fd);
+  free(config_name);
+  free(config);
   libevdev_uinput_destroy(uinput);
   return EXIT_SUCCESS;
 }
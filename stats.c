@@ -0,0 +1,70 @@
+#include "stats.h"
+
+#include <err.h>
+#include <inttypes.h>
+
+static struct stats local_stats;
+struct stats *stats = &local_stats;
+
+void stats_record(struct histogram *histogram, uint64_t value) {
+  if (!stats->enabled)
+    return;
+  const int bucket = value ? 63 - __builtin_clzll(value) : 0;
+  const int last = sizeof(histogram->buckets) / sizeof(*histogram->buckets) - 1;
+  atomic_fetch_add_explicit(&histogram->buckets[bucket < last ? bucket : last],
+                            1, memory_order_relaxed);
+}
+
+void stats_count(atomic_uint_fast64_t *counter, uint64_t n) {
+  if (stats->enabled)
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+uint64_t stats_quantile(const struct histogram *histogram, double quantile) {
+  const int size = sizeof(histogram->buckets) / sizeof(*histogram->buckets);
+  uint64_t counts[size], total = 0;
+  for (int i = 0; i < size; ++i)
+    total += counts[i] = atomic_load_explicit(&histogram->buckets[i],
+                                              memory_order_relaxed);
+  if (total == 0)
+    return 0;
+  const uint64_t rank = (uint64_t)(quantile * (double)(total - 1)) + 1;
+  uint64_t seen = 0;
+  int i = 0;
+  while ((seen += counts[i]) < rank)
+    ++i;
+  return 2ull << i;
+}
+
+[[nodiscard]] static uint64_t load(const atomic_uint_fast64_t *counter) {
+  return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+void stats_dump(void) {
+  if (!stats->enabled) {
+    warnx("stats are disabled");
+    return;
+  }
+  const uint64_t wakeups = load(&stats->wakeups), events = load(&stats->events),
+                 frames = load(&stats->frames);
+  warnx("stats: %" PRIu64 " wakeups, %" PRIu64 " events, %" PRIu64
+        " frames, %" PRIu64 " syscalls, %" PRIu64 " sync drops",
+        wakeups, events, frames, load(&stats->syscalls),
+        load(&stats->sync_drops));
+  warnx("stats: events per wakeup p50 <%" PRIu64 " p99 <%" PRIu64
+        ", syscalls per wakeup p50 <%" PRIu64 " p99 <%" PRIu64,
+        stats_quantile(&stats->events_per_wakeup, 0.5),
+        stats_quantile(&stats->events_per_wakeup, 0.99),
+        stats_quantile(&stats->syscalls_per_wakeup, 0.5),
+        stats_quantile(&stats->syscalls_per_wakeup, 0.99));
+
+  const char *const names[] = {[STATS_BUTTON] = "button",
+                               [STATS_HAT] = "hat",
+                               [STATS_TRIGGER] = "trigger",
+                               [STATS_STICK] = "stick tick"};
+  for (int i = 0; i < STATS_CLASSES; ++i)
+    warnx("stats: %s latency p50 <%.1fus p90 <%.1fus p99 <%.1fus", names[i],
+          (double)stats_quantile(&stats->latency[i], 0.5) / 1e3,
+          (double)stats_quantile(&stats->latency[i], 0.9) / 1e3,
+          (double)stats_quantile(&stats->latency[i], 0.99) / 1e3);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+enum stats_class {
+  STATS_BUTTON,
+  STATS_HAT,
+  STATS_TRIGGER,
+  STATS_STICK,
+  STATS_CLASSES
+};
+
+// bucket i counts values in [2^i, 2^(i+1)), bucket 0 also counts 0
+struct histogram {
+  atomic_uint_fast64_t buckets[40];
+};
+
+// counters are only ever updated with relaxed atomics, so they can be read
+// from another thread at any time
+struct stats {
+  bool enabled;
+  struct histogram latency[STATS_CLASSES];
+  struct histogram events_per_wakeup;
+  struct histogram syscalls_per_wakeup;
+  atomic_uint_fast64_t wakeups, events, frames, syscalls, sync_drops;
+};
+
+// points into the telemetry region if there is one
+extern struct stats *stats;
+
+void stats_record(struct histogram *histogram, uint64_t value);
+void stats_count(atomic_uint_fast64_t *counter, uint64_t n);
+// upper bound of the bucket holding the given quantile, 0 if empty
+[[nodiscard]] uint64_t stats_quantile(const struct histogram *histogram,
+                                      double quantile);
+void stats_dump(void);
@@ -0,0 +1,85 @@
+#include "telemetry.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include <libevdev/libevdev.h>
+
+struct telemetry *telemetry;
+
+bool telemetry_open(const char *path) {
+  const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+  void *region = MAP_FAILED;
+  if (ftruncate(fd, sizeof(struct telemetry)) == 0)
+    region = mmap(nullptr, sizeof(struct telemetry), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, fd, 0);
+  const int error = errno;
+  close(fd);
+  if (region == MAP_FAILED) {
+    unlink(path);
+    errno = error;
+    return false;
+  }
+
+  telemetry = region;
+  memcpy(telemetry->magic, "J2KSTATS", sizeof(telemetry->magic));
+  telemetry->version = TELEMETRY_VERSION;
+  telemetry->size = sizeof(struct telemetry);
+  telemetry->stats.enabled = true;
+  stats = &telemetry->stats;
+  return true;
+}
+
+void telemetry_close(const char *path) {
+  if (telemetry == nullptr)
+    return;
+  munmap(telemetry, sizeof(*telemetry));
+  telemetry = nullptr;
+  unlink(path);
+}
+
+static void set_identity(unsigned int slot, const struct gamepad *pad) {
+  struct telemetry_pad *entry = &telemetry->pads[slot];
+  atomic_fetch_add_explicit(&entry->sequence, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  entry->attached = pad != nullptr;
+  if (pad) {
+    snprintf(entry->name, sizeof(entry->name), "%s",
+             libevdev_get_name(pad->dev));
+    entry->id = pad->id;
+  }
+  atomic_fetch_add_explicit(&entry->sequence, 1, memory_order_release);
+}
+
+void telemetry_attach(unsigned int slot, const struct gamepad *pad) {
+  if (telemetry)
+    set_identity(slot, pad);
+}
+
+void telemetry_detach(unsigned int slot) {
+  if (telemetry)
+    set_identity(slot, nullptr);
+}
+
+void telemetry_update(unsigned int slot, const struct gamepad *pad) {
+  if (telemetry == nullptr)
+    return;
+  struct telemetry_pad *entry = &telemetry->pads[slot];
+  const int sticks[4] = {pad->core.lstick.x, pad->core.lstick.y,
+                         pad->core.rstick.x, pad->core.rstick.y};
+  atomic_store_explicit(&entry->enabled, pad->enabled, memory_order_relaxed);
+  for (int i = 0; i < 4; ++i)
+    atomic_store_explicit(&entry->sticks[i], sticks[i], memory_order_relaxed);
+}
+
+void telemetry_set_tick_rate(int rate) {
+  if (telemetry)
+    atomic_store_explicit(&telemetry->tick_rate, rate, memory_order_relaxed);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "engine.h"
+#include "stats.h"
+
+// a telemetry file is "J2KSTATS", a uint32 version and the size of the whole
+// struct telemetry, in the native layout of this build; the daemon keeps
+// updating it in place, so readers map it shared and sample it at any rate
+#define TELEMETRY_VERSION 1
+
+struct telemetry_pad {
+  // odd while the identity is being changed; readers retry if it is odd or
+  // changed while they copied the identity
+  atomic_uint_fast32_t sequence;
+  bool attached;
+  char name[80];
+  struct device_id id;
+  // updated every wakeup: mapped rather than passed through, and the stick
+  // positions after the deadzone, left x and y and right x and y in ±32767
+  atomic_bool enabled;
+  atomic_int_fast32_t sticks[4];
+};
+
+struct telemetry {
+  char magic[8];
+  uint32_t version, size;
+  // Hz the engine ticks at, 0 while it sleeps until the next event
+  atomic_int_fast32_t tick_rate;
+  struct stats stats;
+  struct telemetry_pad pads[MAX_GAMEPADS];
+};
+
+// nullptr unless telemetry_open() has succeeded
+extern struct telemetry *telemetry;
+
+// create the file and record the stats into it from then on, which enables
+// them; call before starting the engine
+[[nodiscard]] bool telemetry_open(const char *path);
+// remove the file once the stats are no longer needed
+void telemetry_close(const char *path);
+// set the identity of a slot, from the control side
+void telemetry_attach(unsigned int slot, const struct gamepad *pad);
+void telemetry_detach(unsigned int slot);
+// publish the state of a gamepad and the tick rate, from the engine
+void telemetry_update(unsigned int slot, const struct gamepad *pad);
+void telemetry_set_tick_rate(int rate);
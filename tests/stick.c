@@ -0,0 +1,96 @@
+// feeds the left stick through the mapping core, checking that a held
+// deflection is not taken for the resting position and that a noisy stick
+// widens its deadzone until it is still
+
+#include <err.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "core.h"
+
+static struct core core;
+// output events other than SYN_REPORT
+static size_t emitted;
+static void count(void *data, const struct input_event *events, size_t size) {
+  (void)data;
+  for (size_t i = 0; i < size; ++i)
+    emitted += events[i].type != EV_SYN;
+}
+static struct output_frame frame = {.fd = -1, .sink = count};
+static int64_t now;
+
+// a reading of the left stick at x and a tick, a millisecond later
+static void read_x(int x) {
+  now += 1'000'000;
+  const struct input_event events[] = {
+      {.input_event_sec = now / 1'000'000'000,
+       .input_event_usec = now % 1'000'000'000 / 1'000,
+       .type = EV_ABS,
+       .code = ABS_X,
+       .value = x},
+      {.input_event_sec = now / 1'000'000'000,
+       .input_event_usec = now % 1'000'000'000 / 1'000,
+       .type = EV_SYN,
+       .code = SYN_REPORT}};
+  for (size_t i = 0; i < sizeof(events) / sizeof(*events); ++i)
+    core_event(&core, &events[i], &frame);
+  core_tick(&core, now, &frame);
+  frame_flush(&frame);
+}
+
+// ms milliseconds of the left stick held at x
+static void hold(int x, int ms) {
+  while (ms-- > 0)
+    read_x(x);
+}
+
+// readings spread evenly over ±amplitude around the center
+static void jitter(int amplitude, int readings) {
+  while (readings-- > 0)
+    read_x(rand() % (2 * amplitude + 1) - amplitude);
+}
+
+int main(void) {
+  struct config *config = malloc(sizeof(*config));
+  if (config == nullptr)
+    err(EXIT_FAILURE, "failed to allocate config");
+  config_init(config);
+  struct calibration calibration;
+  calibration_init(&calibration);
+
+  core_init(&core, config, &calibration, true, 0);
+  hold(0, 100);
+  hold(3500, 1'000);
+  if (core.lstick.x == 0)
+    errx(EXIT_FAILURE, "a held deflection of 3500 reads centered");
+  hold(6000, 1'000);
+  if (core.lstick.x == 0)
+    errx(EXIT_FAILURE, "a held deflection of 6000 reads centered");
+
+  for (int x = 0; x <= 7000; x += 70)
+    hold(x, 10);
+  hold(7000, 1'000);
+  hold(0, 100);
+  if (core.lstick.x != 0 || core.lstick.y != 0)
+    errx(EXIT_FAILURE, "the released stick reads (%d, %d)", core.lstick.x,
+         core.lstick.y);
+  if (core_active(&core))
+    errx(EXIT_FAILURE, "the released stick keeps the core active");
+
+  // wider than the smallest deadzone, which has to grow to take it in
+  srand(1);
+  core_init(&core, config, &calibration, true, now);
+  jitter(3000, 200'000);
+  emitted = 0;
+  jitter(3000, 10'000);
+  if (emitted)
+    errx(EXIT_FAILURE, "a settled noisy stick emitted %zu events", emitted);
+  if (core_active(&core))
+    errx(EXIT_FAILURE, "a settled noisy stick keeps the core active");
+  read_x(2500);
+  if (core.lstick.x != 0)
+    errx(EXIT_FAILURE, "the deadzone has not grown past its minimum");
+
+  free(config);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,125 @@
+// turns a config file into C source defining builtin_config, which
+// config_init() then uses instead of parsing the built-in defaults
+
+#include <assert.h>
+#include <err.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+
+static void print_curve(FILE *out, const char *name,
+                        const struct curve *curve) {
+  fprintf(out, "    .%s.gain = {", name);
+  for (int i = 0; i < CURVE_SIZE; ++i)
+    fprintf(out, "%s%a", i == 0 ? "\n        " : i % 4 ? ", " : ",\n        ",
+            curve->gain[i]);
+  fprintf(out, "},\n");
+}
+
+// what print_config() writes besides the numbers, so a field added to struct
+// config or struct mapping fails the build here until it is printed too: the
+// shapes and timing are as wide as the numbers, and nothing but padding
+// follows the mapping or the chords
+static_assert(offsetof(struct config, lcurve) ==
+              (CONFIG_NUMBERS + 3) * sizeof(int));
+static_assert(offsetof(struct config, mapping) ==
+              offsetof(struct config, lcurve) + 2 * sizeof(struct curve));
+static_assert(sizeof(struct config) - offsetof(struct config, mapping) -
+                  sizeof(struct mapping) <
+              alignof(struct config));
+static_assert(offsetof(struct mapping, bindings) ==
+              offsetof(struct mapping, combo_table) +
+                  MAX_COMBOS * sizeof(struct combo));
+static_assert(offsetof(struct mapping, chords) ==
+              offsetof(struct mapping, bindings) +
+                  256 * sizeof(struct binding));
+static_assert(sizeof(struct mapping) - offsetof(struct mapping, chords) -
+                  256 * sizeof(struct chord) <
+              alignof(struct mapping));
+
+static void print_config(FILE *out, const struct config *config,
+                         const char *source) {
+  const struct mapping *mapping = &config->mapping;
+  fprintf(out,
+          "// generated by genprofile from %s, do not edit\n\n"
+          "#include \"config.h\"\n\n"
+          "const struct config builtin_config = {\n"
+          "    .event_timing = %s,\n"
+          "    .lshape = %d,\n"
+          "    .rshape = %d,\n",
+          source, config->event_timing ? "true" : "false", config->lshape,
+          config->rshape);
+  for (size_t i = 0; i < CONFIG_NUMBERS; ++i)
+    fprintf(out, "    .%s = %d,\n", config_numbers[i].name,
+            *(const int *)((const char *)config + config_numbers[i].offset));
+  print_curve(out, "lcurve", &config->lcurve);
+  print_curve(out, "rcurve", &config->rcurve);
+
+  for (int layer = 0; layer < MAX_LAYERS; ++layer) {
+    fprintf(out, "    .mapping.keys[%d] = {\n", layer);
+    for (int i = 0; i < KEY_CNT; ++i)
+      if (mapping->keys[layer][i])
+        fprintf(out, "        [%d] = %d,\n", i, mapping->keys[layer][i]);
+    fprintf(out, "    },\n");
+  }
+  fprintf(out, "    .mapping.axes = {\n");
+  for (int i = 0; i < ABS_CNT; ++i)
+    if (mapping->axes[i].role)
+      fprintf(out, "        [%d] = {%d, {%d, %d}, {%d, %d}},\n", i,
+              mapping->axes[i].role, mapping->axes[i].chords[0],
+              mapping->axes[i].chords[1], mapping->axes[i].percent[0],
+              mapping->axes[i].percent[1]);
+  fprintf(out, "    },\n    .mapping.combos = {\n");
+  for (int i = 0; i < KEY_CNT; ++i)
+    if (mapping->combos[i])
+      fprintf(out, "        [%d] = %d,\n", i, mapping->combos[i]);
+  fprintf(out,
+          "    },\n"
+          "    .mapping.combo_count = %u,\n"
+          "    .mapping.binding_count = %u,\n"
+          "    .mapping.chord_count = %u,\n",
+          mapping->combo_count, mapping->binding_count, mapping->chord_count);
+  fprintf(out, "    .mapping.combo_table = {\n");
+  for (unsigned int i = 0; i < mapping->combo_count; ++i) {
+    const struct combo *combo = &mapping->combo_table[i];
+    fprintf(out, "        {{%d, %d}, %d},\n", combo->inputs[0],
+            combo->inputs[1], combo->binding);
+  }
+  fprintf(out, "    },\n    .mapping.bindings = {\n");
+  for (unsigned int i = 1; i < mapping->binding_count; ++i) {
+    const struct binding *binding = &mapping->bindings[i];
+    fprintf(out, "        [%u] = {%d, %d, %d, %s},\n", i, binding->chord,
+            binding->hold_chord, binding->layer,
+            binding->tap_hold ? "true" : "false");
+  }
+  fprintf(out, "    },\n    .mapping.chords = {\n");
+  for (unsigned int i = 1; i < mapping->chord_count; ++i) {
+    const struct chord *chord = &mapping->chords[i];
+    fprintf(out, "        [%u] = {%d, {", i, chord->count);
+    for (unsigned int j = 0; j < chord->count; ++j)
+      fprintf(out, "%s%d", j ? ", " : "", chord->codes[j]);
+    fprintf(out, "}},\n");
+  }
+  fprintf(out, "    },\n};\n");
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "usage: %s profile output\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  struct config config;
+  config_init(&config);
+  if (!config_load(&config, argv[1]))
+    errx(EXIT_FAILURE, "invalid profile");
+
+  FILE *out = fopen(argv[2], "w");
+  if (out == nullptr)
+    err(EXIT_FAILURE, "failed to create %s", argv[2]);
+  print_config(out, &config, argv[1]);
+  if (fclose(out) != 0)
+    err(EXIT_FAILURE, "failed to write %s", argv[2]);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,114 @@
+// samples the telemetry file of a running daemon, see telemetry.h
+
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "telemetry.h"
+
+[[nodiscard]] static uint64_t load(const atomic_uint_fast64_t *counter) {
+  return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+// copy the identity of a slot, retrying while it is being changed
+static void read_identity(const struct telemetry_pad *entry,
+                          struct telemetry_pad *copy) {
+  while (true) {
+    const uint_fast32_t sequence =
+        atomic_load_explicit(&entry->sequence, memory_order_acquire);
+    if (sequence % 2 == 0) {
+      copy->attached = entry->attached;
+      memcpy(copy->name, entry->name, sizeof(copy->name));
+      copy->id = entry->id;
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&entry->sequence, memory_order_relaxed) ==
+          sequence)
+        break;
+    }
+  }
+  copy->name[sizeof(copy->name) - 1] = '\0';
+}
+
+static void print_sample(const struct telemetry *telemetry, double interval,
+                         uint64_t *last_events, uint64_t *last_wakeups) {
+  const struct stats *stats = &telemetry->stats;
+  const uint64_t events = load(&stats->events),
+                 wakeups = load(&stats->wakeups);
+  printf("%.0f events/s, %.0f wakeups/s, ticking at %d Hz, %" PRIu64
+         " sync drops\n",
+         (double)(events - *last_events) / interval,
+         (double)(wakeups - *last_wakeups) / interval,
+         (int)atomic_load_explicit(&telemetry->tick_rate,
+                                   memory_order_relaxed),
+         load(&stats->sync_drops));
+  *last_events = events;
+  *last_wakeups = wakeups;
+
+  const char *const names[] = {[STATS_BUTTON] = "button",
+                               [STATS_HAT] = "hat",
+                               [STATS_TRIGGER] = "trigger",
+                               [STATS_STICK] = "stick tick"};
+  for (int i = 0; i < STATS_CLASSES; ++i)
+    printf("  %s latency p50 <%.1fus p99 <%.1fus\n", names[i],
+           (double)stats_quantile(&stats->latency[i], 0.5) / 1e3,
+           (double)stats_quantile(&stats->latency[i], 0.99) / 1e3);
+
+  for (int slot = 0; slot < MAX_GAMEPADS; ++slot) {
+    const struct telemetry_pad *entry = &telemetry->pads[slot];
+    struct telemetry_pad identity;
+    read_identity(entry, &identity);
+    if (!identity.attached)
+      continue;
+    int sticks[4];
+    for (int i = 0; i < 4; ++i)
+      sticks[i] = (int)atomic_load_explicit(&entry->sticks[i],
+                                            memory_order_relaxed);
+    printf("  %d: %s (%04x:%04x), %s, left %d %d, right %d %d\n", slot,
+           identity.name, identity.id.vendor, identity.id.product,
+           atomic_load_explicit(&entry->enabled, memory_order_relaxed)
+               ? "mapped"
+               : "passed through",
+           sticks[0], sticks[1], sticks[2], sticks[3]);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s telemetry_file [interval]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  const double interval = argc == 3 ? atof(argv[2]) : 1;
+  if (!(interval > 0))
+    errx(EXIT_FAILURE, "invalid interval: %s", argv[2]);
+
+  const int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    err(EXIT_FAILURE, "failed to open %s", argv[1]);
+  const struct telemetry *telemetry = mmap(
+      nullptr, sizeof(struct telemetry), PROT_READ, MAP_SHARED, fd, 0);
+  if (telemetry == MAP_FAILED)
+    err(EXIT_FAILURE, "failed to map %s", argv[1]);
+  close(fd);
+  if (memcmp(telemetry->magic, "J2KSTATS", sizeof(telemetry->magic)) != 0 ||
+      telemetry->version != TELEMETRY_VERSION ||
+      telemetry->size != sizeof(struct telemetry))
+    errx(EXIT_FAILURE, "%s is not a telemetry file of this version",
+         argv[1]);
+
+  uint64_t events = load(&telemetry->stats.events),
+           wakeups = load(&telemetry->stats.wakeups);
+  const struct timespec pause = {(time_t)interval,
+                                 (long)((interval - (time_t)interval) * 1e9)};
+  while (true) {
+    nanosleep(&pause, nullptr);
+    print_sample(telemetry, interval, &events, &wakeups);
+    fflush(stdout);
+  }
+}
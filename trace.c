@@ -0,0 +1,86 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "core.h"
+
+static const char magic[] = "J2KTRACE";
+static const uint32_t version = 2;
+
+// the size of a record, and of the header after the magic
+#define RECORD_SIZE 20
+#define VERSION_SIZE 4
+
+static void put_le(uint8_t *bytes, uint64_t value, int size) {
+  for (int i = 0; i < size; ++i)
+    bytes[i] = (uint8_t)(value >> i * 8);
+}
+
+[[nodiscard]] static uint64_t get_le(const uint8_t *bytes, int size) {
+  uint64_t value = 0;
+  for (int i = 0; i < size; ++i)
+    value |= (uint64_t)bytes[i] << i * 8;
+  return value;
+}
+
+FILE *trace_create(const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (file == nullptr)
+    return nullptr;
+  uint8_t header[VERSION_SIZE];
+  put_le(header, version, VERSION_SIZE);
+  if (fwrite(magic, sizeof(magic) - 1, 1, file) != 1 ||
+      fwrite(header, sizeof(header), 1, file) != 1) {
+    fclose(file);
+    return nullptr;
+  }
+  return file;
+}
+
+FILE *trace_open(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr)
+    return nullptr;
+  char header[sizeof(magic) - 1];
+  uint8_t file_version[VERSION_SIZE];
+  if (fread(header, sizeof(header), 1, file) != 1 ||
+      fread(file_version, sizeof(file_version), 1, file) != 1 ||
+      memcmp(header, magic, sizeof(header)) != 0 ||
+      get_le(file_version, VERSION_SIZE) != version) {
+    fclose(file);
+    errno = EINVAL;
+    return nullptr;
+  }
+  return file;
+}
+
+void trace_write(FILE *file, unsigned int slot, const struct input_event *ev) {
+  uint8_t record[RECORD_SIZE];
+  put_le(record, (uint64_t)event_time(ev), 8);
+  put_le(record + 8, ev->type, 2);
+  put_le(record + 10, ev->code, 2);
+  put_le(record + 12, (uint32_t)ev->value, 4);
+  put_le(record + 16, slot, 4);
+  fwrite(record, sizeof(record), 1, file);
+}
+
+bool trace_read(FILE *file, unsigned int *slot, struct input_event *ev) {
+  uint8_t bytes[RECORD_SIZE];
+  if (fread(bytes, sizeof(bytes), 1, file) != 1)
+    return false;
+  const struct trace_record record = {
+      .time = (int64_t)get_le(bytes, 8),
+      .type = (uint16_t)get_le(bytes + 8, 2),
+      .code = (uint16_t)get_le(bytes + 10, 2),
+      .value = (int32_t)(uint32_t)get_le(bytes + 12, 4),
+      .slot = (uint32_t)get_le(bytes + 16, 4)};
+  *slot = record.slot;
+  *ev = (struct input_event){.input_event_sec = record.time / 1'000'000'000,
+                             .input_event_usec =
+                                 record.time % 1'000'000'000 / 1'000,
+                             .type = record.type,
+                             .code = record.code,
+                             .value = record.value};
+  return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <linux/input.h>
+
+// a trace file is "J2KTRACE", a little endian uint32 version and then one
+// record per gamepad event, also little endian and without padding
+struct trace_record {
+  int64_t time;
+  uint16_t type, code;
+  int32_t value;
+  // the gamepad slot the event was read from
+  uint32_t slot;
+};
+
+[[nodiscard]] FILE *trace_create(const char *path);
+[[nodiscard]] FILE *trace_open(const char *path);
+void trace_write(FILE *file, unsigned int slot, const struct input_event *ev);
+// returns false at the end of the trace
+[[nodiscard]] bool trace_read(FILE *file, unsigned int *slot,
+                              struct input_event *ev);